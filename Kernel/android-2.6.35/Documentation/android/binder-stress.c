@@ -0,0 +1,566 @@
+/*
+ * Transaction throughput and latency stress test for binder.
+ *
+ * Forks a server process that publishes one binder object with the
+ * service manager and answers every transaction on it from a pool of
+ * looper threads, and a number of client processes that look the object
+ * up and then call it back to back with a fixed payload.  The server
+ * replies with a payload of the same size, so each round trip copies the
+ * payload once in each direction.  At the end the combined transaction
+ * rate and the round trip latency distribution of all clients are
+ * reported, which shows how far concurrent callers in different
+ * processes still serialize on the driver's locks.
+ *
+ * Build it from the top of the kernel tree with the target toolchain and
+ * run it as root (or system) on the device, next to a running
+ * servicemanager:
+ *
+ *	arm-eabi-gcc -O2 -static -Idrivers/staging/android \
+ *		-o binder-stress Documentation/android/binder-stress.c \
+ *		-lpthread -lrt
+ *	./binder-stress [-c clients] [-w server_threads] [-s bytes] [-t secs]
+ *
+ * Compare runs with the same arguments on the kernels under test, and
+ * with more clients than CPUs as well as fewer.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define BINDER_VM_SIZE		(1024 * 1024 - 2 * 4096)
+#define STRESS_CODE		1
+
+/* service manager protocol, see frameworks/base/cmds/servicemanager */
+#define SVC_MGR_HANDLE		0
+#define SVC_MGR_CHECK_SERVICE	2
+#define SVC_MGR_ADD_SERVICE	3
+static const char svcmgr_id[] = "android.os.IServiceManager";
+
+/* latency buckets: 1us wide below 1ms, then 64 per power of two */
+#define LAT_LINEAR		1024
+#define LAT_LOG_SHIFT		6
+#define LAT_BUCKETS		(LAT_LINEAR + 16 * (1 << LAT_LOG_SHIFT))
+
+struct client_result {
+	unsigned long calls;
+	unsigned long failed;
+	unsigned long long max_us;
+	unsigned int hist[LAT_BUCKETS];
+};
+
+static int nr_clients = 4;
+static int nr_workers = 4;
+static size_t payload = 256;
+static int seconds = 5;
+static char service_name[64];
+
+static int binder_open_mapped(void **map)
+{
+	struct binder_version vers;
+	int fd;
+
+	fd = open("/dev/binder", O_RDWR);
+	if (fd < 0) {
+		perror("open /dev/binder");
+		return -1;
+	}
+	if (ioctl(fd, BINDER_VERSION, &vers) < 0 ||
+	    vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version mismatch\n");
+		close(fd);
+		return -1;
+	}
+	*map = mmap(NULL, BINDER_VM_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (*map == MAP_FAILED) {
+		perror("mmap /dev/binder");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int binder_write(int fd, void *data, size_t len)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = len;
+	bwr.write_buffer = (unsigned long)data;
+	if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+		perror("BINDER_WRITE_READ write");
+		return -1;
+	}
+	return 0;
+}
+
+static int binder_free_buffer(int fd, const void *ptr)
+{
+	struct {
+		uint32_t cmd;
+		const void *ptr;
+	} __attribute__((packed)) free_cmd = { BC_FREE_BUFFER, ptr };
+
+	return binder_write(fd, &free_cmd, sizeof(free_cmd));
+}
+
+/*
+ * Handles the reference count commands that are queued for the thread
+ * that first passed our object to another process, and skips the rest.
+ * Returns the first BR_TRANSACTION, BR_REPLY or error, and leaves *pos
+ * just past it.
+ */
+static uint32_t binder_next_cmd(int fd, char **pos, char *end,
+				struct binder_transaction_data **txn)
+{
+	while (*pos < end) {
+		uint32_t cmd = *(uint32_t *)*pos;
+		struct binder_ptr_cookie *pc;
+		struct {
+			uint32_t cmd;
+			struct binder_ptr_cookie pc;
+		} __attribute__((packed)) done;
+
+		*pos += sizeof(uint32_t);
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_TRANSACTION_COMPLETE:
+		case BR_SPAWN_LOOPER:
+			break;
+		case BR_INCREFS:
+		case BR_ACQUIRE:
+			pc = (struct binder_ptr_cookie *)*pos;
+			*pos += sizeof(*pc);
+			done.cmd = cmd == BR_INCREFS ?
+				BC_INCREFS_DONE : BC_ACQUIRE_DONE;
+			done.pc = *pc;
+			if (binder_write(fd, &done, sizeof(done)))
+				return BR_FAILED_REPLY;
+			break;
+		case BR_RELEASE:
+		case BR_DECREFS:
+			*pos += sizeof(struct binder_ptr_cookie);
+			break;
+		case BR_DEAD_BINDER:
+		case BR_CLEAR_DEATH_NOTIFICATION_DONE:
+			*pos += sizeof(void *);
+			break;
+		case BR_TRANSACTION:
+		case BR_REPLY:
+			*txn = (struct binder_transaction_data *)*pos;
+			*pos += sizeof(**txn);
+			return cmd;
+		default:
+			return cmd;
+		}
+	}
+	return BR_NOOP;
+}
+
+/* Sends tr to handle and waits for the reply; 0 and *reply on success. */
+static int binder_call(int fd, uint32_t handle, uint32_t code,
+		       const void *data, size_t data_size,
+		       const size_t *offs, size_t offs_size,
+		       struct binder_transaction_data *reply)
+{
+	struct {
+		uint32_t cmd;
+		struct binder_transaction_data tr;
+	} __attribute__((packed)) call;
+	struct binder_write_read bwr;
+	struct binder_transaction_data *txn;
+	uint32_t rbuf[64];
+	char *pos;
+	uint32_t cmd;
+
+	memset(&call, 0, sizeof(call));
+	call.cmd = BC_TRANSACTION;
+	call.tr.target.handle = handle;
+	call.tr.code = code;
+	call.tr.flags = TF_ACCEPT_FDS;
+	call.tr.data_size = data_size;
+	call.tr.offsets_size = offs_size;
+	call.tr.data.ptr.buffer = data;
+	call.tr.data.ptr.offsets = offs;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = sizeof(call);
+	bwr.write_buffer = (unsigned long)&call;
+	for (;;) {
+		bwr.read_size = sizeof(rbuf);
+		bwr.read_consumed = 0;
+		bwr.read_buffer = (unsigned long)rbuf;
+		if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("BINDER_WRITE_READ call");
+			return -1;
+		}
+		bwr.write_size = 0;
+		pos = (char *)rbuf;
+		while (pos < (char *)rbuf + bwr.read_consumed) {
+			cmd = binder_next_cmd(fd, &pos,
+					      (char *)rbuf + bwr.read_consumed,
+					      &txn);
+			if (cmd == BR_REPLY) {
+				*reply = *txn;
+				if (txn->flags & TF_STATUS_CODE) {
+					binder_free_buffer(fd,
+						txn->data.ptr.buffer);
+					return -1;
+				}
+				return 0;
+			}
+			if (cmd == BR_DEAD_REPLY || cmd == BR_FAILED_REPLY) {
+				fprintf(stderr, "transaction failed: %s\n",
+					cmd == BR_DEAD_REPLY ? "dead reply" :
+					"failed reply");
+				return -1;
+			}
+		}
+	}
+}
+
+/* Appends a String16 the way Parcel::writeString16() lays it out. */
+static size_t put_string16(char *buf, const char *s)
+{
+	uint32_t len = strlen(s);
+	uint16_t *p = (uint16_t *)(buf + sizeof(uint32_t));
+	size_t size = sizeof(uint32_t) + ((len + 1) * 2 + 3) / 4 * 4;
+	uint32_t i;
+
+	memset(buf, 0, size);
+	*(uint32_t *)buf = len;
+	for (i = 0; i < len; i++)
+		p[i] = s[i];
+	return size;
+}
+
+static size_t put_svcmgr_header(char *buf)
+{
+	*(uint32_t *)buf = 0;	/* strict mode policy */
+	return sizeof(uint32_t) + put_string16(buf + sizeof(uint32_t),
+					       svcmgr_id);
+}
+
+static void *server_worker(void *arg)
+{
+	int fd = (long)arg;
+	uint32_t enter = BC_ENTER_LOOPER;
+	struct binder_write_read bwr;
+	struct binder_transaction_data *txn;
+	uint32_t rbuf[64];
+	char *reply_data;
+	struct {
+		uint32_t free_cmd;
+		const void *free_ptr;
+		uint32_t reply_cmd;
+		struct binder_transaction_data tr;
+	} __attribute__((packed)) answer;
+	char *pos, *end;
+
+	reply_data = calloc(1, payload ? payload : 1);
+	if (!reply_data || binder_write(fd, &enter, sizeof(enter)))
+		return NULL;
+
+	memset(&bwr, 0, sizeof(bwr));
+	for (;;) {
+		bwr.read_size = sizeof(rbuf);
+		bwr.read_consumed = 0;
+		bwr.read_buffer = (unsigned long)rbuf;
+		if (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("BINDER_WRITE_READ server");
+			return NULL;
+		}
+		pos = (char *)rbuf;
+		end = pos + bwr.read_consumed;
+		while (pos < end) {
+			if (binder_next_cmd(fd, &pos, end, &txn) !=
+			    BR_TRANSACTION)
+				continue;
+			memset(&answer, 0, sizeof(answer));
+			answer.free_cmd = BC_FREE_BUFFER;
+			answer.free_ptr = txn->data.ptr.buffer;
+			answer.reply_cmd = BC_REPLY;
+			answer.tr.data_size = payload;
+			answer.tr.data.ptr.buffer = reply_data;
+			if (txn->flags & TF_ONE_WAY) {
+				binder_write(fd, &answer, sizeof(uint32_t) +
+					     sizeof(void *));
+				continue;
+			}
+			binder_write(fd, &answer, sizeof(answer));
+		}
+	}
+	return NULL;
+}
+
+static int run_server(int ready_fd)
+{
+	struct flat_binder_object obj;
+	struct binder_transaction_data reply;
+	size_t max_threads = 0, offs, len;
+	pthread_t thread;
+	char buf[512];
+	void *map;
+	int fd, i;
+
+	fd = binder_open_mapped(&map);
+	if (fd < 0)
+		return 1;
+	/* a fixed pool, so never ask for more loopers */
+	ioctl(fd, BINDER_SET_MAX_THREADS, &max_threads);
+
+	len = put_svcmgr_header(buf);
+	len += put_string16(buf + len, service_name);
+	offs = len;
+	memset(&obj, 0, sizeof(obj));
+	obj.type = BINDER_TYPE_BINDER;
+	obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	obj.binder = (void *)&run_server;
+	obj.cookie = NULL;
+	memcpy(buf + len, &obj, sizeof(obj));
+	len += sizeof(obj);
+
+	for (i = 0; i < nr_workers; i++)
+		if (pthread_create(&thread, NULL, server_worker,
+				   (void *)(long)fd)) {
+			perror("pthread_create");
+			return 1;
+		}
+
+	if (binder_call(fd, SVC_MGR_HANDLE, SVC_MGR_ADD_SERVICE, buf, len,
+			&offs, sizeof(offs), &reply)) {
+		fprintf(stderr, "could not add service %s\n", service_name);
+		return 1;
+	}
+	binder_free_buffer(fd, reply.data.ptr.buffer);
+
+	write(ready_fd, "r", 1);
+	close(ready_fd);
+	for (;;)
+		pause();
+	return 0;
+}
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int lat_bucket(unsigned long long us)
+{
+	int shift;
+
+	if (us < LAT_LINEAR)
+		return us;
+	shift = 63 - __builtin_clzll(us) - LAT_LOG_SHIFT;
+	us >>= shift;
+	us -= 1 << LAT_LOG_SHIFT;
+	us += (shift - 4) << LAT_LOG_SHIFT;
+	if (LAT_LINEAR + us >= LAT_BUCKETS)
+		return LAT_BUCKETS - 1;
+	return LAT_LINEAR + us;
+}
+
+/* lower bound of a bucket, in microseconds */
+static unsigned long long lat_value(int bucket)
+{
+	int shift;
+
+	if (bucket < LAT_LINEAR)
+		return bucket;
+	bucket -= LAT_LINEAR;
+	shift = bucket >> LAT_LOG_SHIFT;
+	return (unsigned long long)((bucket & ((1 << LAT_LOG_SHIFT) - 1)) +
+				    (1 << LAT_LOG_SHIFT)) << (shift + 4);
+}
+
+static int run_client(int result_fd)
+{
+	struct client_result *res;
+	struct binder_transaction_data reply;
+	struct flat_binder_object *obj;
+	unsigned long long start, end, t0, t1;
+	uint32_t handle;
+	struct {
+		uint32_t cmd;
+		uint32_t handle;
+	} __attribute__((packed)) acquire;
+	char buf[512];
+	char *data;
+	size_t len;
+	void *map;
+	int fd;
+
+	res = calloc(1, sizeof(*res));
+	data = calloc(1, payload ? payload : 1);
+	if (!res || !data)
+		return 1;
+	fd = binder_open_mapped(&map);
+	if (fd < 0)
+		return 1;
+
+	len = put_svcmgr_header(buf);
+	len += put_string16(buf + len, service_name);
+	if (binder_call(fd, SVC_MGR_HANDLE, SVC_MGR_CHECK_SERVICE, buf, len,
+			NULL, 0, &reply) ||
+	    reply.offsets_size < sizeof(size_t)) {
+		fprintf(stderr, "service %s not found\n", service_name);
+		return 1;
+	}
+	obj = (struct flat_binder_object *)((char *)reply.data.ptr.buffer +
+		*(size_t *)reply.data.ptr.offsets);
+	handle = obj->handle;
+	acquire.cmd = BC_ACQUIRE;
+	acquire.handle = handle;
+	binder_write(fd, &acquire, sizeof(acquire));
+	binder_free_buffer(fd, reply.data.ptr.buffer);
+
+	start = now_us();
+	end = start + seconds * 1000000ULL;
+	do {
+		t0 = now_us();
+		if (binder_call(fd, handle, STRESS_CODE, data, payload,
+				NULL, 0, &reply)) {
+			res->failed++;
+			t1 = now_us();
+			continue;
+		}
+		t1 = now_us();
+		binder_free_buffer(fd, reply.data.ptr.buffer);
+		res->calls++;
+		res->hist[lat_bucket(t1 - t0)]++;
+		if (t1 - t0 > res->max_us)
+			res->max_us = t1 - t0;
+	} while (t1 < end);
+
+	if (write(result_fd, res, sizeof(*res)) != sizeof(*res))
+		return 1;
+	return 0;
+}
+
+static unsigned long long percentile(struct client_result *sum,
+				     unsigned int per_mille)
+{
+	unsigned long long want, seen = 0;
+	int i;
+
+	want = (sum->calls * per_mille + 999) / 1000;
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += sum->hist[i];
+		if (seen >= want)
+			return lat_value(i);
+	}
+	return sum->max_us;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-c clients] [-w server_threads] "
+		"[-s payload_bytes] [-t seconds]\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct client_result res, sum;
+	int ready[2], results[2];
+	pid_t server;
+	int opt, i, status, ok = 0;
+	char c;
+
+	while ((opt = getopt(argc, argv, "c:w:s:t:")) != -1) {
+		switch (opt) {
+		case 'c':
+			nr_clients = atoi(optarg);
+			break;
+		case 'w':
+			nr_workers = atoi(optarg);
+			break;
+		case 's':
+			payload = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_clients < 1 || nr_workers < 1 || seconds < 1 ||
+	    payload > BINDER_VM_SIZE / 4)
+		usage(argv[0]);
+	snprintf(service_name, sizeof(service_name), "binder_stress.%d",
+		 getpid());
+
+	if (pipe(ready) || pipe(results)) {
+		perror("pipe");
+		return 1;
+	}
+	server = fork();
+	if (server == 0) {
+		close(ready[0]);
+		exit(run_server(ready[1]));
+	}
+	close(ready[1]);
+	if (server < 0 || read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "server did not start\n");
+		return 1;
+	}
+
+	for (i = 0; i < nr_clients; i++) {
+		if (fork() == 0) {
+			close(results[0]);
+			exit(run_client(results[1]));
+		}
+	}
+	close(results[1]);
+
+	memset(&sum, 0, sizeof(sum));
+	while (read(results[0], &res, sizeof(res)) == sizeof(res)) {
+		ok++;
+		sum.calls += res.calls;
+		sum.failed += res.failed;
+		if (res.max_us > sum.max_us)
+			sum.max_us = res.max_us;
+		for (i = 0; i < LAT_BUCKETS; i++)
+			sum.hist[i] += res.hist[i];
+	}
+	for (i = 0; i < nr_clients; i++)
+		wait(&status);
+	kill(server, SIGKILL);
+	waitpid(server, &status, 0);
+
+	if (ok != nr_clients)
+		fprintf(stderr, "%d of %d clients failed\n",
+			nr_clients - ok, nr_clients);
+	if (!sum.calls)
+		return 1;
+
+	printf("%d clients, %d server threads, %zu byte payload, %d s\n",
+	       nr_clients, nr_workers, payload, seconds);
+	printf("transactions: %lu (%lu/s), failed %lu\n", sum.calls,
+	       sum.calls / seconds, sum.failed);
+	printf("round trip us: p50 %llu p90 %llu p99 %llu p99.9 %llu "
+	       "max %llu\n", percentile(&sum, 500), percentile(&sum, 900),
+	       percentile(&sum, 990), percentile(&sum, 999), sum.max_us);
+	return ok == nr_clients ? 0 : 1;
+}
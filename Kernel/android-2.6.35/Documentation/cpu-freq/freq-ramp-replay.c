@@ -0,0 +1,288 @@
+/*
+ * Frequency ramp latency benchmark for cpufreq governors.
+ *
+ * Replays a recorded load trace on one CPU and samples scaling_cur_freq
+ * while it runs. For every step from light to heavy load it reports how
+ * long the governor takes to reach the target frequency; for every step
+ * back to light load, how long it takes to come down to the minimum.
+ *
+ * The trace is a text file with one segment per line:
+ *
+ *	<duration in ms> <busy percent>
+ *
+ * Lines starting with '#' are ignored. Busy time is spread over 10 ms
+ * periods, so "200 30" runs 3 ms and sleeps 7 ms, twenty times.
+ *
+ * Build it with the target toolchain and run it as root:
+ *
+ *	arm-eabi-gcc -O2 -static -o freq-ramp-replay freq-ramp-replay.c \
+ *		-lpthread -lrt
+ *	./freq-ramp-replay [-c cpu] [-f target_khz] [-b] trace.txt
+ *
+ * -f sets the frequency that counts as "ramped up" (default: the CPU's
+ * maximum). -b writes to the policy's boost_cpufreq file at the start of
+ * every heavy segment, the way an input event would boost the governor.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define PERIOD_US		10000
+#define SAMPLE_US		1000
+#define HEAVY_PCT		60
+#define MAX_SEGMENTS		4096
+
+struct segment {
+	unsigned int ms;
+	unsigned int busy;
+};
+
+static struct segment segments[MAX_SEGMENTS];
+static int nr_segments;
+
+static int cpu;
+static int boost;
+static unsigned int target_khz, min_khz;
+static char freq_path[128], boost_path[128];
+
+/* written by the sampler thread, read by the replay loop */
+static volatile unsigned int cur_khz;
+static volatile int stop;
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static unsigned int read_khz(const char *path)
+{
+	char buf[32];
+	int fd, n;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return 0;
+	buf[n] = 0;
+	return strtoul(buf, NULL, 10);
+}
+
+static void write_one(const char *path)
+{
+	int fd = open(path, O_WRONLY);
+
+	if (fd < 0)
+		return;
+	if (write(fd, "1", 1) != 1)
+		perror(path);
+	close(fd);
+}
+
+static void *sampler(void *arg __attribute__((unused)))
+{
+	struct timespec ts = { 0, SAMPLE_US * 1000 };
+
+	while (!stop) {
+		cur_khz = read_khz(freq_path);
+		nanosleep(&ts, NULL);
+	}
+	return NULL;
+}
+
+static void busy_until(unsigned long long end)
+{
+	while (now_us() < end)
+		;
+}
+
+static void sleep_until(unsigned long long end)
+{
+	unsigned long long now = now_us();
+	struct timespec ts;
+
+	if (now >= end)
+		return;
+	ts.tv_sec = (end - now) / 1000000;
+	ts.tv_nsec = ((end - now) % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+struct ramp_stats {
+	unsigned int count, missed;
+	unsigned long long total_us, max_us;
+};
+
+static void ramp_add(struct ramp_stats *s, long long us)
+{
+	if (us < 0) {
+		s->missed++;
+		return;
+	}
+	s->count++;
+	s->total_us += us;
+	if ((unsigned long long)us > s->max_us)
+		s->max_us = us;
+}
+
+static void ramp_print(const char *name, struct ramp_stats *s)
+{
+	printf("%-5s %4u steps  avg %7llu us  max %7llu us  %u never reached\n",
+	       name, s->count, s->count ? s->total_us / s->count : 0,
+	       s->max_us, s->missed);
+}
+
+/*
+ * Runs one segment and returns the time, from its start, until the
+ * frequency first satisfied 'reached', or -1 if it never did.
+ */
+static long long run_segment(struct segment *seg, int up)
+{
+	unsigned long long start = now_us(), end = start + seg->ms * 1000ULL;
+	unsigned long long period, busy_end;
+	long long reached = -1;
+
+	for (period = start; period < end; period += PERIOD_US) {
+		busy_end = period + PERIOD_US * seg->busy / 100;
+		if (busy_end > end)
+			busy_end = end;
+
+		while (now_us() < busy_end) {
+			if (reached < 0 && (up ? cur_khz >= target_khz :
+						 cur_khz <= min_khz))
+				reached = now_us() - start;
+			busy_until(now_us() + 100);
+		}
+		if (reached < 0 && (up ? cur_khz >= target_khz :
+					 cur_khz <= min_khz))
+			reached = now_us() - start;
+		sleep_until(period + PERIOD_US < end ? period + PERIOD_US : end);
+	}
+	return reached;
+}
+
+static void load_trace(const char *file)
+{
+	char line[128];
+	FILE *f = fopen(file, "r");
+
+	if (!f) {
+		perror(file);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f) && nr_segments < MAX_SEGMENTS) {
+		struct segment *seg = &segments[nr_segments];
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%u %u", &seg->ms, &seg->busy) != 2 ||
+		    seg->busy > 100) {
+			fprintf(stderr, "bad trace line: %s", line);
+			exit(1);
+		}
+		nr_segments++;
+	}
+	fclose(f);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-c cpu] [-f target_khz] [-b] trace\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct ramp_stats up = { 0 }, down = { 0 };
+	struct sched_param param = { .sched_priority = 1 };
+	char path[128];
+	cpu_set_t set;
+	pthread_t thread;
+	int opt, i, prev_heavy = 0;
+
+	while ((opt = getopt(argc, argv, "c:f:b")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'f':
+			target_khz = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			boost = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	load_trace(argv[optind]);
+
+	snprintf(freq_path, sizeof(freq_path),
+		 "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+	snprintf(boost_path, sizeof(boost_path),
+		 "/sys/devices/system/cpu/cpu%d/cpufreq/boost_cpufreq", cpu);
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_min_freq", cpu);
+	min_khz = read_khz(path);
+	if (!target_khz) {
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/"
+			 "cpufreq/scaling_max_freq", cpu);
+		target_khz = read_khz(path);
+	}
+	if (!min_khz || !target_khz || !read_khz(freq_path)) {
+		fprintf(stderr, "cpu%d has no cpufreq policy\n", cpu);
+		return 1;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		perror("sched_setaffinity");
+
+	cur_khz = read_khz(freq_path);
+	if (pthread_create(&thread, NULL, sampler, NULL)) {
+		perror("pthread_create");
+		return 1;
+	}
+	/* the sampler must not wait behind the replayed load */
+	pthread_setschedparam(thread, SCHED_FIFO, &param);
+
+	printf("cpu%d: %d segments, ramp target %u kHz, min %u kHz%s\n",
+	       cpu, nr_segments, target_khz, min_khz,
+	       boost ? ", boosting" : "");
+
+	for (i = 0; i < nr_segments; i++) {
+		int heavy = segments[i].busy >= HEAVY_PCT;
+		long long us;
+
+		if (heavy && !prev_heavy && boost)
+			write_one(boost_path);
+
+		us = run_segment(&segments[i], heavy);
+		if (heavy != prev_heavy)
+			ramp_add(heavy ? &up : &down, us);
+		prev_heavy = heavy;
+	}
+
+	stop = 1;
+	pthread_join(thread, NULL);
+
+	ramp_print("up", &up);
+	ramp_print("down", &down);
+	return 0;
+}
@@ -0,0 +1,454 @@
+/*
+ * Allocation trace replay for the PowerVR services resource allocator.
+ *
+ * Builds drivers/gpu/pvr/ra.c and hash.c in user mode, replays a trace of
+ * RA_Alloc/RA_Free calls against one arena and reports the throughput of
+ * the replay and how fragmented the arena's free space gets on the way.
+ *
+ * The trace is a text file with one call per line:
+ *
+ *	a <id> <size> [<alignment>]
+ *	f <id>
+ *
+ * 'a' allocates size bytes and remembers the result as id, 'f' frees the
+ * allocation made under id. Sizes and alignments may be given in hex with
+ * a 0x prefix; the alignment defaults to the arena quantum. Lines starting
+ * with '#' are ignored. Without a trace file a synthetic one is generated,
+ * and -g writes that trace to stdout instead of replaying it, so that the
+ * same trace can be replayed against another version of ra.c.
+ *
+ * Build it on the host from the top of the kernel tree:
+ *
+ *	gcc -O2 -Idrivers/gpu/pvr -o ra-replay Documentation/pvr/ra-replay.c
+ *	./ra-replay [-s arena_mb] [-q quantum] [-r repeats] [-n ops] [-g]
+ *		[trace.txt]
+ *
+ * The trace is replayed once with checks and then -r times against the
+ * clock, on a fresh arena each time, and the fastest run is reported. The
+ * checked run verifies every allocation's alignment and that it does not
+ * overlap its neighbours, so a broken allocator shows up as an error
+ * rather than as a good score. It also samples fragmentation every 1024
+ * calls: the share of the free space that lies outside the largest free
+ * segment.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Stand-ins for the services headers, which only build in the kernel.
+ * Defining their guards keeps ra.c and hash.c from pulling them in.
+ */
+#define __IMG_TYPES_H__
+#define __IMG_DEFS_H__
+#define __OSFUNC_H__
+#define __PVR_DEBUG_H__
+#define __SERVICES_H__
+#define __SERVICESINT_H__
+#define __SERVICES_PROC_H__
+#define SERVICES_HEADERS_H
+#define _BUFFER_MANAGER_H_
+
+typedef void		IMG_VOID, *IMG_PVOID;
+typedef char		IMG_CHAR;
+typedef unsigned char	IMG_BYTE;
+typedef int		IMG_INT, IMG_INT32;
+typedef unsigned int	IMG_UINT, IMG_UINT32;
+typedef uintptr_t	IMG_UINTPTR_T;
+typedef unsigned int	IMG_SIZE_T;
+typedef void		*IMG_HANDLE;
+typedef enum { IMG_FALSE = 0, IMG_TRUE = 1 } IMG_BOOL;
+typedef struct { IMG_UINTPTR_T uiAddr; } IMG_CPU_PHYADDR;
+
+typedef enum {
+	PVRSRV_OK = 0,
+	PVRSRV_ERROR_OUT_OF_MEMORY,
+	PVRSRV_ERROR_INVALID_PARAMS,
+} PVRSRV_ERROR;
+
+#define IMG_NULL			NULL
+#define IMG_UNDEF			(~0UL)
+#define PVRSRV_OS_PAGEABLE_HEAP		0
+#define PVRSRV_PAGEABLE_SELECT		0
+
+#define PVR_DBG_ERROR			0
+#define PVR_DBG_MESSAGE			1
+#define PVR_DPF(x)			do { } while (0)
+#define PVR_TRACE(x)			do { } while (0)
+#define PVR_DBG_BREAK			abort()
+#define PVR_UNREFERENCED_PARAMETER(x)	((void)(x))
+#define PVR_ASSERT(x)							\
+	do {								\
+		if (!(x)) {						\
+			fprintf(stderr, "%s:%d: assertion %s failed\n",	\
+				__FILE__, __LINE__, #x);		\
+			abort();					\
+		}							\
+	} while (0)
+
+#define __ffs(x)			__builtin_ctz(x)
+
+struct _BM_MAPPING_ {
+	IMG_UINT32 ui32Flags;
+};
+
+static PVRSRV_ERROR OSAllocMem(IMG_UINT32 ui32Flags, IMG_SIZE_T uSize,
+			       IMG_PVOID *ppvAddr, IMG_HANDLE *phBlock,
+			       const IMG_CHAR *pszName)
+{
+	*ppvAddr = malloc(uSize);
+	return *ppvAddr ? PVRSRV_OK : PVRSRV_ERROR_OUT_OF_MEMORY;
+}
+
+static PVRSRV_ERROR OSFreeMem(IMG_UINT32 ui32Flags, IMG_SIZE_T uSize,
+			      IMG_PVOID pvAddr, IMG_HANDLE hBlock)
+{
+	free(pvAddr);
+	return PVRSRV_OK;
+}
+
+#define OSMemSet(p, c, n)	memset(p, c, n)
+#define OSMemCopy(d, s, n)	memcpy(d, s, n)
+#define OSSNPrintf		snprintf
+
+#include "hash.c"
+#include "ra.c"
+
+#define ARENA_BASE	0x10000000UL
+#define SAMPLE_CALLS	1024
+
+struct call {
+	unsigned int	id;
+	unsigned int	free;
+	IMG_SIZE_T	size;
+	IMG_UINT32	align;
+};
+
+struct live {
+	IMG_UINTPTR_T	base;
+	IMG_SIZE_T	size;
+};
+
+static struct call *calls;
+static unsigned int nr_calls, max_calls;
+static unsigned int nr_ids;
+static struct live *live;
+
+static IMG_SIZE_T arena_size = 256 << 20;
+static IMG_SIZE_T quantum = 4096;
+
+static void add_call(unsigned int id, unsigned int free_it, IMG_SIZE_T size,
+		     IMG_UINT32 align)
+{
+	if (nr_calls == max_calls) {
+		max_calls = max_calls ? 2 * max_calls : 4096;
+		calls = realloc(calls, max_calls * sizeof(*calls));
+		if (!calls) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	calls[nr_calls].id = id;
+	calls[nr_calls].free = free_it;
+	calls[nr_calls].size = size;
+	calls[nr_calls].align = align;
+	nr_calls++;
+	if (id >= nr_ids)
+		nr_ids = id + 1;
+}
+
+static void read_trace(const char *path)
+{
+	unsigned long long size, align;
+	char line[256], op;
+	unsigned int id;
+	FILE *f;
+	int n;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		align = quantum;
+		n = sscanf(line, " %c %u %lli %lli", &op, &id, &size, &align);
+		if (op == 'a' && n >= 3 && size)
+			add_call(id, 0, size, align);
+		else if (op == 'f' && n >= 2)
+			add_call(id, 1, 0, 0);
+		else {
+			fprintf(stderr, "bad trace line: %s", line);
+			exit(1);
+		}
+	}
+	fclose(f);
+}
+
+/*
+ * Roughly what the SGX heaps see: mostly small buffers, some render
+ * targets and textures, short and long lived, a quarter of them 64 KB
+ * aligned. About a third of the arena is live in the steady state.
+ */
+static void make_trace(unsigned int ops)
+{
+	unsigned int *ids, nr_live = 0, next_id = 0, i, j;
+	IMG_SIZE_T live_bytes = 0, *sizes;
+	IMG_SIZE_T size;
+
+	ids = malloc(ops * sizeof(*ids));
+	sizes = malloc(ops * sizeof(*sizes));
+	if (!ids || !sizes) {
+		perror("malloc");
+		exit(1);
+	}
+	srand(1);
+	for (i = 0; i < ops; i++) {
+		if (nr_live && (live_bytes > arena_size / 3 || rand() % 2)) {
+			j = rand() % nr_live;
+			add_call(ids[j], 1, 0, 0);
+			live_bytes -= sizes[ids[j]];
+			ids[j] = ids[--nr_live];
+			continue;
+		}
+		switch (rand() % 16) {
+		case 0:
+			size = (1 + rand() % 32) << 18;		/* textures */
+			break;
+		case 1: case 2: case 3:
+			size = (1 + rand() % 64) << 14;		/* targets */
+			break;
+		default:
+			size = (1 + rand() % 64) << 8;		/* buffers */
+			break;
+		}
+		size = (size + quantum - 1) & ~(quantum - 1);
+		sizes[next_id] = size;
+		live_bytes += size;
+		ids[nr_live++] = next_id;
+		add_call(next_id++, 0, size, rand() % 4 ? quantum : 65536);
+	}
+	free(sizes);
+	free(ids);
+}
+
+static void write_trace(void)
+{
+	unsigned int i;
+
+	printf("# ra-replay trace, %u calls\n", nr_calls);
+	for (i = 0; i < nr_calls; i++) {
+		if (calls[i].free)
+			printf("f %u\n", calls[i].id);
+		else
+			printf("a %u %#lx %#x\n", calls[i].id,
+			       (unsigned long)calls[i].size, calls[i].align);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* percentage of the free space outside the largest free segment */
+static unsigned int fragmentation(RA_ARENA *arena, IMG_SIZE_T *free_bytes)
+{
+	IMG_SIZE_T total = 0, largest = 0;
+	BT *bt;
+
+	for (bt = arena->pHeadSegment; bt; bt = bt->pNextSegment) {
+		if (bt->type != btt_free)
+			continue;
+		total += bt->uSize;
+		if (bt->uSize > largest)
+			largest = bt->uSize;
+	}
+	*free_bytes = total;
+	return total ? 100 - (unsigned int)(100ULL * largest / total) : 0;
+}
+
+/* does [base, base + size) overlap a live allocation next to it? */
+static int overlaps(RA_ARENA *arena, IMG_UINTPTR_T base, IMG_SIZE_T size)
+{
+	BT *bt = (BT *)HASH_Retrieve(arena->pSegmentHash, base);
+
+	if (!bt || bt->type != btt_live || bt->base != base || bt->uSize < size)
+		return 1;
+	if (bt->pPrevSegment && bt->pPrevSegment->type != btt_span &&
+	    bt->pPrevSegment->base + bt->pPrevSegment->uSize > base)
+		return 1;
+	if (bt->pNextSegment && bt->pNextSegment->type != btt_span &&
+	    bt->pNextSegment->base < base + size)
+		return 1;
+	return 0;
+}
+
+struct result {
+	double		time;
+	unsigned long	allocs, frees, failed;
+	unsigned int	frag_max, frag_sum, samples;
+	IMG_SIZE_T	free_min;
+};
+
+static void sample(RA_ARENA *arena, struct result *res)
+{
+	IMG_SIZE_T free_bytes;
+	unsigned int frag;
+
+	frag = fragmentation(arena, &free_bytes);
+	if (frag > res->frag_max)
+		res->frag_max = frag;
+	if (free_bytes < res->free_min)
+		res->free_min = free_bytes;
+	res->frag_sum += frag;
+	res->samples++;
+}
+
+/*
+ * Replays the whole trace on a fresh arena. With 'check' set every
+ * allocation is verified and fragmentation is sampled; otherwise the
+ * replay is only timed.
+ */
+static int replay(struct result *res, int check)
+{
+	IMG_UINTPTR_T base;
+	RA_ARENA *arena;
+	struct call *c;
+	unsigned int i;
+	double t;
+
+	memset(res, 0, sizeof(*res));
+	res->free_min = arena_size;
+	memset(live, 0, nr_ids * sizeof(*live));
+
+	arena = RA_Create("replay", ARENA_BASE, arena_size, NULL, quantum,
+			  NULL, NULL, NULL, NULL);
+	if (!arena) {
+		fprintf(stderr, "RA_Create failed\n");
+		return 1;
+	}
+
+	t = now();
+	for (i = 0, c = calls; i < nr_calls; i++, c++) {
+		if (c->free) {
+			if (live[c->id].base) {
+				RA_Free(arena, live[c->id].base, IMG_FALSE);
+				live[c->id].base = 0;
+				res->frees++;
+			}
+		} else if (RA_Alloc(arena, c->size, NULL, NULL, 0, c->align, 0,
+				    &base)) {
+			live[c->id].base = base;
+			live[c->id].size = c->size;
+			res->allocs++;
+			if (check && (base % c->align ||
+				      overlaps(arena, base, c->size))) {
+				fprintf(stderr, "call %u: bad allocation "
+					"%#lx+%#lx\n", i, (unsigned long)base,
+					(unsigned long)c->size);
+				return 1;
+			}
+		} else
+			res->failed++;
+
+		if (check && (i + 1) % SAMPLE_CALLS == 0)
+			sample(arena, res);
+	}
+	res->time = now() - t;
+	if (check)
+		sample(arena, res);
+
+	for (i = 0; i < nr_ids; i++)
+		if (live[i].base)
+			RA_Free(arena, live[i].base, IMG_FALSE);
+	RA_Delete(arena);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: ra-replay [-s arena_mb] [-q quantum] "
+		"[-r repeats] [-n ops] [-g] [trace.txt]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int repeats = 5, ops = 1000000, i;
+	struct result stats, res;
+	int generate = 0;
+	double best = 0;
+
+	while (argc > 1 && argv[1][0] == '-') {
+		if (!strcmp(argv[1], "-g")) {
+			generate = 1;
+			argv++, argc--;
+			continue;
+		}
+		if (argc < 3)
+			usage();
+		switch (argv[1][1]) {
+		case 's':
+			arena_size = (IMG_SIZE_T)strtoul(argv[2], NULL, 0) << 20;
+			break;
+		case 'q':
+			quantum = strtoul(argv[2], NULL, 0);
+			break;
+		case 'r':
+			repeats = strtoul(argv[2], NULL, 0);
+			break;
+		case 'n':
+			ops = strtoul(argv[2], NULL, 0);
+			break;
+		default:
+			usage();
+		}
+		argv += 2, argc -= 2;
+	}
+	if (!arena_size || !quantum || (quantum & (quantum - 1)) || !repeats)
+		usage();
+
+	if (argc > 1)
+		read_trace(argv[1]);
+	else
+		make_trace(ops);
+	if (generate) {
+		write_trace();
+		return 0;
+	}
+
+	live = calloc(nr_ids, sizeof(*live));
+	if (!live) {
+		perror("calloc");
+		return 1;
+	}
+
+	/* one checked run for fragmentation, then the timed ones */
+	if (replay(&stats, 1))
+		return 1;
+	for (i = 0; i < repeats; i++) {
+		if (replay(&res, 0))
+			return 1;
+		if (!i || res.time < best)
+			best = res.time;
+	}
+
+	printf("%u calls: %lu allocs, %lu failed, %lu frees; "
+	       "%lu MB arena, %lu byte quantum\n", nr_calls, stats.allocs,
+	       stats.failed, stats.frees, (unsigned long)(arena_size >> 20),
+	       (unsigned long)quantum);
+	printf("best of %u: %.3f s, %.0f ns/call\n", repeats, best,
+	       best * 1e9 / nr_calls);
+	printf("fragmentation %u%% average, %u%% worst, least free %lu KB\n",
+	       stats.frag_sum / stats.samples, stats.frag_max,
+	       (unsigned long)(stats.free_min >> 10));
+	return 0;
+}
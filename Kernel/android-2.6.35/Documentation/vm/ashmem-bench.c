@@ -0,0 +1,206 @@
+/*
+ * Pin/unpin churn benchmark for ashmem.
+ *
+ * Creates one ashmem region, unpins every other chunk of it so that the
+ * driver has to track many disjoint unpinned ranges, and then repeatedly
+ * pins, unpins and queries randomly chosen chunks. The time spent in each
+ * ioctl is reported, which makes the cost of range lookups visible as the
+ * number of unpinned ranges grows.
+ *
+ * Build it with the target toolchain and run it on the device:
+ *
+ *	arm-eabi-gcc -O2 -static -o ashmem-bench ashmem-bench.c -lrt
+ *	./ashmem-bench [-p pages] [-c chunk_pages] [-n iterations]
+ *
+ * Pages are touched before they are unpinned, so the run also exercises
+ * the shrinker when memory is tight; purged pins are counted separately.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/types.h>
+
+/* Mirrors include/linux/ashmem.h, which is not exported to userspace. */
+#define ASHMEM_NAME_LEN		256
+#define ASHMEM_WAS_PURGED	1
+#define ASHMEM_IS_PINNED	1
+
+struct ashmem_pin {
+	__u32 offset;
+	__u32 len;
+};
+
+#define __ASHMEMIOC		0x77
+#define ASHMEM_SET_NAME		_IOW(__ASHMEMIOC, 1, char[ASHMEM_NAME_LEN])
+#define ASHMEM_SET_SIZE		_IOW(__ASHMEMIOC, 3, size_t)
+#define ASHMEM_PIN		_IOW(__ASHMEMIOC, 7, struct ashmem_pin)
+#define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
+#define ASHMEM_GET_PIN_STATUS	_IO(__ASHMEMIOC, 9)
+
+enum { OP_PIN, OP_UNPIN, OP_STATUS, NR_OPS };
+
+static const char *op_names[NR_OPS] = { "pin", "unpin", "status" };
+static const unsigned long op_cmds[NR_OPS] = {
+	ASHMEM_PIN, ASHMEM_UNPIN, ASHMEM_GET_PIN_STATUS
+};
+
+struct op_stats {
+	unsigned long count;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+};
+
+static struct op_stats stats[NR_OPS];
+static unsigned long purged;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int do_op(int fd, int op, unsigned long offset, unsigned long len)
+{
+	struct ashmem_pin pin = { .offset = offset, .len = len };
+	unsigned long long start, ns;
+	int ret;
+
+	start = now_ns();
+	ret = ioctl(fd, op_cmds[op], &pin);
+	ns = now_ns() - start;
+
+	if (ret < 0) {
+		perror(op_names[op]);
+		exit(1);
+	}
+
+	stats[op].count++;
+	stats[op].total_ns += ns;
+	if (ns > stats[op].max_ns)
+		stats[op].max_ns = ns;
+
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-p pages] [-c chunk_pages] "
+		"[-n iterations]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long pages = 16384, chunk = 1, iterations = 200000;
+	unsigned long page_size = sysconf(_SC_PAGESIZE);
+	unsigned long nr_chunks, i, c, len;
+	unsigned char *pinned;
+	unsigned long long start, elapsed;
+	char *addr;
+	int fd, opt, op;
+
+	while ((opt = getopt(argc, argv, "p:c:n:")) != -1) {
+		switch (opt) {
+		case 'p':
+			pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			chunk = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!pages || !chunk || chunk > pages)
+		usage(argv[0]);
+
+	nr_chunks = pages / chunk;
+	len = chunk * page_size;
+
+	fd = open("/dev/ashmem", O_RDWR);
+	if (fd < 0) {
+		perror("/dev/ashmem");
+		return 1;
+	}
+
+	if (ioctl(fd, ASHMEM_SET_NAME, "ashmem-bench") < 0 ||
+	    ioctl(fd, ASHMEM_SET_SIZE, pages * page_size) < 0) {
+		perror("ashmem setup");
+		return 1;
+	}
+
+	addr = mmap(NULL, pages * page_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	pinned = malloc(nr_chunks);
+	if (!pinned) {
+		perror("malloc");
+		return 1;
+	}
+	memset(pinned, 1, nr_chunks);
+
+	for (i = 0; i < pages; i++)
+		addr[i * page_size] = 1;
+
+	/* Start with every other chunk unpinned: nr_chunks / 2 ranges. */
+	for (c = 0; c < nr_chunks; c += 2) {
+		do_op(fd, OP_UNPIN, c * len, len);
+		pinned[c] = 0;
+	}
+
+	printf("%lu pages, %lu-page chunks, %lu iterations\n",
+	       pages, chunk, iterations);
+
+	srand(1);
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		c = (unsigned long)rand() % nr_chunks;
+
+		if (rand() & 3) {
+			op = pinned[c] ? OP_UNPIN : OP_PIN;
+			if (do_op(fd, op, c * len, len) == ASHMEM_WAS_PURGED)
+				purged++;
+			pinned[c] = !pinned[c];
+			if (pinned[c])
+				addr[c * len] = 1;
+		} else {
+			if ((do_op(fd, OP_STATUS, c * len, len) ==
+			     ASHMEM_IS_PINNED) != pinned[c]) {
+				fprintf(stderr, "chunk %lu: bad pin status\n", c);
+				return 1;
+			}
+		}
+	}
+	elapsed = now_ns() - start;
+
+	for (op = 0; op < NR_OPS; op++) {
+		if (!stats[op].count)
+			continue;
+		printf("%-7s %10lu calls  avg %6llu ns  max %8llu ns\n",
+		       op_names[op], stats[op].count,
+		       stats[op].total_ns / stats[op].count, stats[op].max_ns);
+	}
+	printf("%llu ops/s, %lu pins found purged\n",
+	       elapsed ? iterations * 1000000000ULL / elapsed : 0, purged);
+
+	munmap(addr, pages * page_size);
+	close(fd);
+	free(pinned);
+
+	return 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * arch/arm/crypto/aes_glue.h
+ *
+ * Entry points of the ARM assembler AES block cipher, for the modules
+ * that fall back to it.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _ARM_CRYPTO_AES_GLUE_H
+#define _ARM_CRYPTO_AES_GLUE_H
+
+#include <linux/linkage.h>
+#include <crypto/aes.h>
+
+asmlinkage void __aes_arm_encrypt(struct crypto_aes_ctx *ctx, u8 *out,
+				  const u8 *in);
+asmlinkage void __aes_arm_decrypt(struct crypto_aes_ctx *ctx, u8 *out,
+				  const u8 *in);
+
+#endif
@@ -0,0 +1,459 @@
+/*
+ * Glue code for the bit-sliced NEON version of AES
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The NEON code encrypts or decrypts eight independent blocks per call,
+ * so it serves the modes that have them: ecb, cbc decryption, ctr and
+ * xts.  Whatever is left over, cbc encryption, and callers that may not
+ * enter a kernel_neon_begin() section (hard irq context or interrupts
+ * off) go through the scalar code of aes-arm instead.
+ */
+
+#include <linux/module.h>
+#include <linux/crypto.h>
+#include <linux/hardirq.h>
+#include <linux/irqflags.h>
+#include <crypto/aes.h>
+#include <crypto/algapi.h>
+#include <crypto/b128ops.h>
+#include <crypto/gf128mul.h>
+#include <asm/neon.h>
+
+#include "aes_glue.h"
+
+#define AESBS_BLOCKS	8
+#define AESBS_BYTES	(AESBS_BLOCKS * AES_BLOCK_SIZE)
+#define AESBS_KEY_BYTES	(8 * AES_BLOCK_SIZE)
+
+asmlinkage void aesbs_encrypt8(const u8 *rk, int rounds, u8 *out,
+			       const u8 *in);
+asmlinkage void aesbs_decrypt8(const u8 *rk, int rounds, u8 *out,
+			       const u8 *in);
+
+/* the bit-sliced keys come first, as crypto_tfm_ctx() is cache aligned */
+struct aesbs_ctx {
+	u8 rk[(AES_MAX_KEYLENGTH_U32 / 4) * AESBS_KEY_BYTES];
+	int rounds;
+	struct crypto_aes_ctx fallback;
+};
+
+struct aesbs_xts_ctx {
+	struct aesbs_ctx key;
+	struct crypto_aes_ctx tweak;
+};
+
+/*
+ * Widen every bit of the round keys to a byte of 0x00 or 0xff, in the
+ * plane order of aesbs-neon.S.  Keys after the first also take the 0x63
+ * that the S-box circuit leaves out.
+ */
+static void aesbs_convert_key(u8 *rk, const u32 *key_enc, int rounds)
+{
+	int r, i, j;
+
+	for (r = 0; r <= rounds; r++, key_enc += 4) {
+		for (i = 0; i < 8; i++) {
+			for (j = 0; j < AES_BLOCK_SIZE; j++) {
+				u8 b = key_enc[j / 4] >> (8 * (j % 4));
+
+				if (r)
+					b ^= 0x63;
+				*rk++ = (b >> (7 - i)) & 1 ? 0xff : 0;
+			}
+		}
+	}
+}
+
+static int aesbs_expand_key(struct crypto_tfm *tfm, struct aesbs_ctx *ctx,
+			    const u8 *in_key, unsigned int key_len)
+{
+	int err = crypto_aes_expand_key(&ctx->fallback, in_key, key_len);
+
+	if (err) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return err;
+	}
+	ctx->rounds = 6 + key_len / 4;
+	aesbs_convert_key(ctx->rk, ctx->fallback.key_enc, ctx->rounds);
+	return 0;
+}
+
+static int aesbs_set_key(struct crypto_tfm *tfm, const u8 *in_key,
+			 unsigned int key_len)
+{
+	return aesbs_expand_key(tfm, crypto_tfm_ctx(tfm), in_key, key_len);
+}
+
+/* data key first, tweak key second, as for the xts template */
+static int aesbs_xts_set_key(struct crypto_tfm *tfm, const u8 *in_key,
+			     unsigned int key_len)
+{
+	struct aesbs_xts_ctx *ctx = crypto_tfm_ctx(tfm);
+	int err;
+
+	if (key_len % 2) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+	key_len /= 2;
+	err = aesbs_expand_key(tfm, &ctx->key, in_key, key_len);
+	if (err)
+		return err;
+	err = crypto_aes_expand_key(&ctx->tweak, in_key + key_len, key_len);
+	if (err)
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+	return err;
+}
+
+/* kernel_neon_begin() must not be called where it would BUG */
+static inline bool aesbs_use_neon(unsigned int nbytes)
+{
+	return nbytes >= AESBS_BYTES && !in_irq() && !irqs_disabled();
+}
+
+static int aesbs_ecb_crypt(struct blkcipher_desc *desc,
+			   struct scatterlist *dst, struct scatterlist *src,
+			   unsigned int nbytes, bool enc)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, AESBS_BYTES);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *out = walk.dst.virt.addr;
+		u8 *in = walk.src.virt.addr;
+
+		if (aesbs_use_neon(nbytes)) {
+			kernel_neon_begin();
+			do {
+				if (enc)
+					aesbs_encrypt8(ctx->rk, ctx->rounds,
+						       out, in);
+				else
+					aesbs_decrypt8(ctx->rk, ctx->rounds,
+						       out, in);
+				out += AESBS_BYTES;
+				in += AESBS_BYTES;
+				nbytes -= AESBS_BYTES;
+			} while (nbytes >= AESBS_BYTES);
+			kernel_neon_end();
+		}
+		for (; nbytes >= AES_BLOCK_SIZE; nbytes -= AES_BLOCK_SIZE) {
+			if (enc)
+				__aes_arm_encrypt(&ctx->fallback, out, in);
+			else
+				__aes_arm_decrypt(&ctx->fallback, out, in);
+			out += AES_BLOCK_SIZE;
+			in += AES_BLOCK_SIZE;
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+static int aesbs_ecb_encrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int nbytes)
+{
+	return aesbs_ecb_crypt(desc, dst, src, nbytes, true);
+}
+
+static int aesbs_ecb_decrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int nbytes)
+{
+	return aesbs_ecb_crypt(desc, dst, src, nbytes, false);
+}
+
+/* each block depends on the one before, so this is all scalar */
+static int aesbs_cbc_encrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt(desc, &walk);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *out = walk.dst.virt.addr;
+		u8 *in = walk.src.virt.addr;
+
+		for (; nbytes >= AES_BLOCK_SIZE; nbytes -= AES_BLOCK_SIZE) {
+			crypto_xor(walk.iv, in, AES_BLOCK_SIZE);
+			__aes_arm_encrypt(&ctx->fallback, out, walk.iv);
+			memcpy(walk.iv, out, AES_BLOCK_SIZE);
+			out += AES_BLOCK_SIZE;
+			in += AES_BLOCK_SIZE;
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+/*
+ * The ciphertext is kept until all eight blocks are done, so this works
+ * in place as well.
+ */
+static int aesbs_cbc_decrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	u8 buf[AESBS_BYTES];
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, AESBS_BYTES);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *out = walk.dst.virt.addr;
+		u8 *in = walk.src.virt.addr;
+
+		if (aesbs_use_neon(nbytes)) {
+			kernel_neon_begin();
+			do {
+				aesbs_decrypt8(ctx->rk, ctx->rounds, buf, in);
+				crypto_xor(buf, walk.iv, AES_BLOCK_SIZE);
+				crypto_xor(buf + AES_BLOCK_SIZE, in,
+					   AESBS_BYTES - AES_BLOCK_SIZE);
+				memcpy(walk.iv, in + AESBS_BYTES - AES_BLOCK_SIZE,
+				       AES_BLOCK_SIZE);
+				memcpy(out, buf, AESBS_BYTES);
+				out += AESBS_BYTES;
+				in += AESBS_BYTES;
+				nbytes -= AESBS_BYTES;
+			} while (nbytes >= AESBS_BYTES);
+			kernel_neon_end();
+		}
+		for (; nbytes >= AES_BLOCK_SIZE; nbytes -= AES_BLOCK_SIZE) {
+			__aes_arm_decrypt(&ctx->fallback, buf, in);
+			crypto_xor(buf, walk.iv, AES_BLOCK_SIZE);
+			memcpy(walk.iv, in, AES_BLOCK_SIZE);
+			memcpy(out, buf, AES_BLOCK_SIZE);
+			out += AES_BLOCK_SIZE;
+			in += AES_BLOCK_SIZE;
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+/*
+ * The walk hands out at least AESBS_BYTES at a time unless less is left,
+ * so a partial block can only turn up in the last chunk.
+ */
+static int aesbs_ctr_encrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	u8 buf[AESBS_BYTES];
+	int err, i;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, AESBS_BYTES);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *out = walk.dst.virt.addr;
+		u8 *in = walk.src.virt.addr;
+
+		if (aesbs_use_neon(nbytes)) {
+			kernel_neon_begin();
+			do {
+				for (i = 0; i < AESBS_BLOCKS; i++) {
+					memcpy(buf + i * AES_BLOCK_SIZE,
+					       walk.iv, AES_BLOCK_SIZE);
+					crypto_inc(walk.iv, AES_BLOCK_SIZE);
+				}
+				aesbs_encrypt8(ctx->rk, ctx->rounds, buf, buf);
+				crypto_xor(buf, in, AESBS_BYTES);
+				memcpy(out, buf, AESBS_BYTES);
+				out += AESBS_BYTES;
+				in += AESBS_BYTES;
+				nbytes -= AESBS_BYTES;
+			} while (nbytes >= AESBS_BYTES);
+			kernel_neon_end();
+		}
+		while (nbytes) {
+			unsigned int n = min_t(unsigned int, nbytes,
+					       AES_BLOCK_SIZE);
+
+			if (n < AES_BLOCK_SIZE && walk.nbytes != walk.total)
+				break;
+			__aes_arm_encrypt(&ctx->fallback, buf, walk.iv);
+			crypto_inc(walk.iv, AES_BLOCK_SIZE);
+			crypto_xor(buf, in, n);
+			memcpy(out, buf, n);
+			out += n;
+			in += n;
+			nbytes -= n;
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+/*
+ * The tweak lives in walk.iv, encrypted with the tweak key on the first
+ * chunk and multiplied by x after every block, as in crypto/xts.c.  The
+ * alignmask keeps it and the data u64 aligned for the be128 helpers.
+ */
+static int aesbs_xts_crypt(struct blkcipher_desc *desc,
+			   struct scatterlist *dst, struct scatterlist *src,
+			   unsigned int nbytes, bool enc)
+{
+	struct aesbs_xts_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct aesbs_ctx *key = &ctx->key;
+	struct blkcipher_walk walk;
+	be128 tweak[AESBS_BLOCKS];
+	int err, i;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, AESBS_BYTES);
+	if (walk.nbytes)
+		__aes_arm_encrypt(&ctx->tweak, walk.iv, walk.iv);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *out = walk.dst.virt.addr;
+		u8 *in = walk.src.virt.addr;
+
+		if (aesbs_use_neon(nbytes)) {
+			kernel_neon_begin();
+			do {
+				for (i = 0; i < AESBS_BLOCKS; i++) {
+					memcpy(&tweak[i], walk.iv,
+					       AES_BLOCK_SIZE);
+					gf128mul_x_ble((be128 *)walk.iv,
+						       &tweak[i]);
+					be128_xor((be128 *)out + i,
+						  (be128 *)in + i, &tweak[i]);
+				}
+				if (enc)
+					aesbs_encrypt8(key->rk, key->rounds,
+						       out, out);
+				else
+					aesbs_decrypt8(key->rk, key->rounds,
+						       out, out);
+				crypto_xor(out, (u8 *)tweak, AESBS_BYTES);
+				out += AESBS_BYTES;
+				in += AESBS_BYTES;
+				nbytes -= AESBS_BYTES;
+			} while (nbytes >= AESBS_BYTES);
+			kernel_neon_end();
+		}
+		for (; nbytes >= AES_BLOCK_SIZE; nbytes -= AES_BLOCK_SIZE) {
+			be128_xor((be128 *)out, (be128 *)in,
+				  (be128 *)walk.iv);
+			if (enc)
+				__aes_arm_encrypt(&key->fallback, out, out);
+			else
+				__aes_arm_decrypt(&key->fallback, out, out);
+			crypto_xor(out, walk.iv, AES_BLOCK_SIZE);
+			gf128mul_x_ble((be128 *)walk.iv, (be128 *)walk.iv);
+			out += AES_BLOCK_SIZE;
+			in += AES_BLOCK_SIZE;
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+static int aesbs_xts_encrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int nbytes)
+{
+	return aesbs_xts_crypt(desc, dst, src, nbytes, true);
+}
+
+static int aesbs_xts_decrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst, struct scatterlist *src,
+			     unsigned int nbytes)
+{
+	return aesbs_xts_crypt(desc, dst, src, nbytes, false);
+}
+
+#define AESBS_ALG(mode, bsize, amask, ctx, ivlen, keymul, set_key, enc, dec) \
+{									\
+	.cra_name		= #mode "(aes)",			\
+	.cra_driver_name	= #mode "-aes-neonbs",			\
+	.cra_priority		= 300,					\
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,		\
+	.cra_blocksize		= bsize,				\
+	.cra_alignmask		= amask,				\
+	.cra_ctxsize		= sizeof(struct ctx),			\
+	.cra_type		= &crypto_blkcipher_type,		\
+	.cra_module		= THIS_MODULE,				\
+	.cra_u	= {							\
+		.blkcipher = {						\
+			.min_keysize	= (keymul) * AES_MIN_KEY_SIZE,	\
+			.max_keysize	= (keymul) * AES_MAX_KEY_SIZE,	\
+			.ivsize		= ivlen,			\
+			.setkey		= set_key,			\
+			.encrypt	= enc,				\
+			.decrypt	= dec,				\
+		}							\
+	}								\
+}
+
+static struct crypto_alg aesbs_algs[] = {
+	AESBS_ALG(ecb, AES_BLOCK_SIZE, 0, aesbs_ctx, 0, 1, aesbs_set_key,
+		  aesbs_ecb_encrypt, aesbs_ecb_decrypt),
+	AESBS_ALG(cbc, AES_BLOCK_SIZE, 0, aesbs_ctx, AES_BLOCK_SIZE, 1,
+		  aesbs_set_key, aesbs_cbc_encrypt, aesbs_cbc_decrypt),
+	AESBS_ALG(ctr, 1, 0, aesbs_ctx, AES_BLOCK_SIZE, 1, aesbs_set_key,
+		  aesbs_ctr_encrypt, aesbs_ctr_encrypt),
+	AESBS_ALG(xts, AES_BLOCK_SIZE, __alignof__(u64) - 1, aesbs_xts_ctx,
+		  AES_BLOCK_SIZE, 2, aesbs_xts_set_key, aesbs_xts_encrypt,
+		  aesbs_xts_decrypt),
+};
+
+static int __init aesbs_init(void)
+{
+	int i, err;
+
+	/* vfp_init() is a core_initcall, so this holds when built in too */
+	if (!cpu_has_neon())
+		return -ENODEV;
+
+	for (i = 0; i < ARRAY_SIZE(aesbs_algs); i++) {
+		INIT_LIST_HEAD(&aesbs_algs[i].cra_list);
+		err = crypto_register_alg(&aesbs_algs[i]);
+		if (err)
+			goto unregister;
+	}
+	return 0;
+
+unregister:
+	while (--i >= 0)
+		crypto_unregister_alg(&aesbs_algs[i]);
+	return err;
+}
+
+static void __exit aesbs_fini(void)
+{
+	int i;
+
+	for (i = ARRAY_SIZE(aesbs_algs) - 1; i >= 0; i--)
+		crypto_unregister_alg(&aesbs_algs[i]);
+}
+
+module_init(aesbs_init);
+module_exit(aesbs_fini);
+
+MODULE_DESCRIPTION("Bit-sliced AES in ECB, CBC, CTR and XTS modes using NEON");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("ecb(aes)");
+MODULE_ALIAS("cbc(aes)");
+MODULE_ALIAS("ctr(aes)");
+MODULE_ALIAS("xts(aes)");
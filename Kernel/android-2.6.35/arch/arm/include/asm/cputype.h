@@ -94,4 +94,17 @@ static inline int cpu_is_xsc3(void)
 #define	cpu_is_xscale()	1
 #endif
 
+/*
+ * Cortex-A8, any revision, for the copy routines tuned to its 64 byte
+ * lines and NEON unit.
+ */
+#ifndef CONFIG_CPU_V7
+#define cpu_is_cortex_a8()	0
+#else
+static inline int cpu_is_cortex_a8(void)
+{
+	return (read_cpuid_id() & 0xff0ffff0) == 0x410fc080;
+}
+#endif
+
 #endif
@@ -0,0 +1,28 @@
+/*
+ * arch/arm/include/asm/neon.h
+ *
+ * Kernel-mode NEON support.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+/*
+ * NEON may only be used between these two calls, in process or softirq
+ * context.  Softirqs (and so preemption) are disabled in between, and
+ * the NEON code itself should live in a separate file built with
+ * -mfpu=neon, so that the compiler cannot hoist it outside the section.
+ */
+extern void kernel_neon_begin(void);
+extern void kernel_neon_end(void);
+#endif
+
+#endif /* __ASM_ARM_NEON_H */
@@ -150,6 +150,9 @@ extern void __cpu_copy_user_highpage(struct page *to, struct page *from,
 
 #define clear_page(page)	memset((void *)(page), 0, PAGE_SIZE)
 extern void copy_page(void *to, const void *from);
+#ifdef CONFIG_KERNEL_MODE_NEON
+extern void copy_page_neon(void *to, const void *from);
+#endif
 
 #undef STRICT_MM_TYPECHECKS
 
@@ -132,10 +132,98 @@ static struct xor_block_template xor_block_arm4regs = {
 	.do_5	= xor_arm4regs_5,
 };
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+#include <linux/hardirq.h>
+#include <linux/irqflags.h>
+#include <asm/neon.h>
+
+extern void xor_neon_2(unsigned long, unsigned long *, unsigned long *);
+extern void xor_neon_3(unsigned long, unsigned long *, unsigned long *,
+		       unsigned long *);
+extern void xor_neon_4(unsigned long, unsigned long *, unsigned long *,
+		       unsigned long *, unsigned long *);
+extern void xor_neon_5(unsigned long, unsigned long *, unsigned long *,
+		       unsigned long *, unsigned long *, unsigned long *);
+
+/*
+ * kernel_neon_begin() may not be used from hard irq context or with
+ * irqs off, so the NEON template falls back to arm4regs there.
+ */
+#define xor_neon_usable()	(!in_irq() && !irqs_disabled())
+
+static void
+xor_neon_wrap_2(unsigned long bytes, unsigned long *p1, unsigned long *p2)
+{
+	if (xor_neon_usable()) {
+		kernel_neon_begin();
+		xor_neon_2(bytes, p1, p2);
+		kernel_neon_end();
+	} else
+		xor_arm4regs_2(bytes, p1, p2);
+}
+
+static void
+xor_neon_wrap_3(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3)
+{
+	if (xor_neon_usable()) {
+		kernel_neon_begin();
+		xor_neon_3(bytes, p1, p2, p3);
+		kernel_neon_end();
+	} else
+		xor_arm4regs_3(bytes, p1, p2, p3);
+}
+
+static void
+xor_neon_wrap_4(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3, unsigned long *p4)
+{
+	if (xor_neon_usable()) {
+		kernel_neon_begin();
+		xor_neon_4(bytes, p1, p2, p3, p4);
+		kernel_neon_end();
+	} else
+		xor_arm4regs_4(bytes, p1, p2, p3, p4);
+}
+
+static void
+xor_neon_wrap_5(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3, unsigned long *p4, unsigned long *p5)
+{
+	if (xor_neon_usable()) {
+		kernel_neon_begin();
+		xor_neon_5(bytes, p1, p2, p3, p4, p5);
+		kernel_neon_end();
+	} else
+		xor_arm4regs_5(bytes, p1, p2, p3, p4, p5);
+}
+
+static struct xor_block_template xor_block_neon = {
+	.name	= "neon",
+	.do_2	= xor_neon_wrap_2,
+	.do_3	= xor_neon_wrap_3,
+	.do_4	= xor_neon_wrap_4,
+	.do_5	= xor_neon_wrap_5,
+};
+
+/*
+ * A built-in calibrate_xor_blocks() is a core_initcall.  vfp_init() is one
+ * too and arch/arm/vfp links ahead of crypto/, so HWCAP_NEON is set here.
+ */
+#define NEON_TEMPLATES				\
+	do {					\
+		if (cpu_has_neon())		\
+			xor_speed(&xor_block_neon); \
+	} while (0)
+#else
+#define NEON_TEMPLATES	do { } while (0)
+#endif
+
 #undef XOR_TRY_TEMPLATES
 #define XOR_TRY_TEMPLATES			\
 	do {					\
 		xor_speed(&xor_block_arm4regs);	\
 		xor_speed(&xor_block_8regs);	\
 		xor_speed(&xor_block_32regs);	\
+		NEON_TEMPLATES;			\
 	} while (0)
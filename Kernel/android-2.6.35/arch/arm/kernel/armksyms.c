@@ -49,6 +49,12 @@ extern void __aeabi_ulcmp(void);
 
 extern void fpundefinstr(void);
 
+/* arch/arm/lib/xor-neon.S, prototypes in asm/xor.h */
+extern void xor_neon_2(void);
+extern void xor_neon_3(void);
+extern void xor_neon_4(void);
+extern void xor_neon_5(void);
+
 
 EXPORT_SYMBOL(__backtrace);
 
@@ -97,6 +103,9 @@ EXPORT_SYMBOL(__strncpy_from_user);
 
 #ifdef CONFIG_MMU
 EXPORT_SYMBOL(copy_page);
+#ifdef CONFIG_KERNEL_MODE_NEON
+EXPORT_SYMBOL(copy_page_neon);
+#endif
 
 EXPORT_SYMBOL(__copy_from_user);
 EXPORT_SYMBOL(__copy_to_user);
@@ -115,6 +124,14 @@ EXPORT_SYMBOL(__put_user_8);
 	/* crypto hash */
 EXPORT_SYMBOL(sha_transform);
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+	/* raid xor */
+EXPORT_SYMBOL(xor_neon_2);
+EXPORT_SYMBOL(xor_neon_3);
+EXPORT_SYMBOL(xor_neon_4);
+EXPORT_SYMBOL(xor_neon_5);
+#endif
+
 	/* gcc lib functions */
 EXPORT_SYMBOL(__ashldi3);
 EXPORT_SYMBOL(__ashrdi3);
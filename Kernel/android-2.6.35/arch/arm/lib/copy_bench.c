@@ -0,0 +1,345 @@
+/*
+ *  linux/arch/arm/lib/copy_bench.c
+ *
+ *  Correctness sweep and throughput benchmark for the copy routines.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * memcpy(), __copy_from_user() and __copy_to_user() are checked against
+ * a byte at a time copy for every length up to a few prefetch distances
+ * and every source/destination offset modulo 8, including the bytes
+ * around the destination.  copy_page() and, on Cortex-A8 with kernel
+ * mode NEON, copy_page_neon() are checked the same way.  Throughput is
+ * then reported for a range of sizes and alignments.  On Cortex-A8 the
+ * page copy of a copy-on-write fault is also timed with and without NEON,
+ * including the VFP save and reload that NEON costs a task using VFP, as
+ * "copypage_neon" should only be turned on where that pays off.  The
+ * module always fails to load once the run is over, so it can simply be
+ * insmod'ed again:
+ *
+ *	insmod copy_bench.ko
+ *	dmesg | tail -20
+ */
+
+#define KMSG_COMPONENT "copy_bench"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/preempt.h>
+#include <linux/random.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <asm/cputype.h>
+#include <asm/neon.h>
+#include <asm/page.h>
+
+#define BENCH_MAX	(1 << 20)
+#define BENCH_SLACK	(2 * PAGE_SIZE)
+#define CHECK_MAX	(4 * 64 + 32)
+#define CHECK_GUARD	16
+
+static unsigned int msecs = 10;
+module_param(msecs, uint, 0);
+MODULE_PARM_DESC(msecs, "Time spent on each throughput measurement");
+
+typedef unsigned long (*copy_fn)(void *to, const void *from, unsigned long n);
+
+struct copy_routine {
+	const char	*name;
+	copy_fn		fn;
+	unsigned int	page_sized;	/* page aligned whole pages only */
+};
+
+static void *bench_src, *bench_dst, *bench_ref;
+
+static unsigned long copy_bytes(void *to, const void *from, unsigned long n)
+{
+	unsigned char *d = to;
+	const unsigned char *s = from;
+
+	while (n--)
+		*d++ = *s++;
+	return 0;
+}
+
+static unsigned long bench_memcpy(void *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static unsigned long bench_copy_from_user(void *to, const void *from,
+					  unsigned long n)
+{
+	return __copy_from_user(to, (const void __user *)from, n);
+}
+
+static unsigned long bench_copy_to_user(void *to, const void *from,
+					unsigned long n)
+{
+	return __copy_to_user((void __user *)to, from, n);
+}
+
+static unsigned long bench_copy_page(void *to, const void *from,
+				     unsigned long n)
+{
+	unsigned long off;
+
+	for (off = 0; off < n; off += PAGE_SIZE)
+		copy_page(to + off, from + off);
+	return 0;
+}
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+static unsigned long bench_copy_page_neon(void *to, const void *from,
+					  unsigned long n)
+{
+	unsigned long off;
+
+	for (off = 0; off < n; off += PAGE_SIZE) {
+		kernel_neon_begin();
+		copy_page_neon(to + off, from + off);
+		kernel_neon_end();
+	}
+	return 0;
+}
+#endif
+
+static struct copy_routine copy_routines[] = {
+	{ "memcpy",		bench_memcpy,		0 },
+	{ "copy_from_user",	bench_copy_from_user,	0 },
+	{ "copy_to_user",	bench_copy_to_user,	0 },
+	{ "copy_page",		bench_copy_page,	1 },
+#ifdef CONFIG_KERNEL_MODE_NEON
+	{ "copy_page_neon",	bench_copy_page_neon,	1 },
+#endif
+};
+
+static int __init copy_check_one(struct copy_routine *r, unsigned long len,
+				 unsigned int soff, unsigned int doff)
+{
+	unsigned long span = doff + len + CHECK_GUARD;
+
+	memset(bench_dst, 0x55, span);
+	memset(bench_ref, 0x55, span);
+	copy_bytes(bench_ref + doff, bench_src + soff, len);
+
+	if (r->fn(bench_dst + doff, bench_src + soff, len) ||
+	    memcmp(bench_dst, bench_ref, span)) {
+		pr_err("%s: %lu bytes from offset %u to offset %u failed\n",
+		       r->name, len, soff, doff);
+		return 1;
+	}
+	return 0;
+}
+
+static int __init copy_check(struct copy_routine *r)
+{
+	static const unsigned long large[] __initconst = {
+		1023, 1024, 4095, 4096, 4097, 65536 + 3
+	};
+	unsigned int soff, doff;
+	unsigned long len;
+	int errors = 0, i;
+
+	if (r->page_sized) {
+		errors += copy_check_one(r, PAGE_SIZE, 0, 0);
+		errors += copy_check_one(r, 16 * PAGE_SIZE, 0, 0);
+		return errors;
+	}
+
+	for (soff = 0; soff < 8; soff++)
+		for (doff = 0; doff < 8; doff++) {
+			for (len = 0; len <= CHECK_MAX; len++)
+				errors += copy_check_one(r, len, soff, doff);
+			for (i = 0; i < ARRAY_SIZE(large); i++)
+				errors += copy_check_one(r, large[i],
+							 soff, doff);
+			if (errors)
+				return errors;
+		}
+	return errors;
+}
+
+/* MB/s of back to back copies over about msecs milliseconds */
+static unsigned int __init copy_speed(struct copy_routine *r,
+				      unsigned long len,
+				      unsigned int soff, unsigned int doff)
+{
+	u64 bytes = 0, elapsed;
+	ktime_t start;
+	int i;
+
+	start = ktime_get();
+	do {
+		for (i = 0; i < 16; i++)
+			r->fn(bench_dst + doff, bench_src + soff, len);
+		bytes += 16 * len;
+		elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	} while (elapsed < (u64)msecs * NSEC_PER_MSEC);
+
+	return div64_u64(bytes * 1000, elapsed);
+}
+
+static void __init copy_bench(struct copy_routine *r)
+{
+	static const unsigned long sizes[] __initconst = {
+		64, 256, 1024, 4096, 16384, 65536, BENCH_MAX
+	};
+	static const unsigned int offs[][2] __initconst = {
+		{ 0, 0 }, { 0, 1 }, { 1, 0 }, { 2, 3 }
+	};
+	unsigned int mbs[ARRAY_SIZE(offs)];
+	unsigned long len;
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		len = sizes[i];
+		if (r->page_sized) {
+			if (len < PAGE_SIZE)
+				continue;
+			pr_info("%-14s %7lu bytes: %5u MB/s\n", r->name, len,
+				copy_speed(r, len, 0, 0));
+			continue;
+		}
+		for (j = 0; j < ARRAY_SIZE(offs); j++)
+			mbs[j] = copy_speed(r, len, offs[j][0], offs[j][1]);
+		pr_info("%-14s %7lu bytes: %5u %5u %5u %5u MB/s "
+			"(src/dst offsets 0/0 0/1 1/0 2/3)\n", r->name, len,
+			mbs[0], mbs[1], mbs[2], mbs[3]);
+	}
+}
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+/*
+ * Read FPSCR.  While the unit is disabled, as kernel_neon_end() leaves it,
+ * this takes the undefined instruction trap that the faulting task takes
+ * on its next VFP instruction, and reloads current's VFP state so that
+ * the following kernel_neon_begin() has to save it again.  The trap is
+ * taken from SVC rather than USR mode, but both go through call_fpe and
+ * vfp_support_entry.
+ */
+static inline void vfp_touch(void)
+{
+	u32 fpscr;
+
+	asm volatile("mrc p10, 7, %0, cr1, cr0, 0 @ fmrx %0, FPSCR"
+		     : "=r" (fpscr) : : "cc");
+}
+
+enum { COW_INT, COW_NEON, COW_NEON_VFP };
+
+/*
+ * ns per page for the copy part of a copy-on-write fault, going through
+ * pages of a buffer larger than the L2 cache as the faults would.
+ */
+static unsigned int __init cow_speed(int mode)
+{
+	unsigned long nr_pages = BENCH_MAX / PAGE_SIZE, pages = 0, off;
+	u64 elapsed;
+	ktime_t start;
+	int i;
+
+	/* keep the state being saved and reloaded on this CPU */
+	preempt_disable();
+	start = ktime_get();
+	do {
+		for (i = 0; i < 16; i++, pages++) {
+			off = (pages % nr_pages) * PAGE_SIZE;
+			if (mode == COW_INT) {
+				copy_page(bench_dst + off, bench_src + off);
+				continue;
+			}
+			if (mode == COW_NEON_VFP)
+				vfp_touch();
+			kernel_neon_begin();
+			copy_page_neon(bench_dst + off, bench_src + off);
+			kernel_neon_end();
+		}
+		elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+	} while (elapsed < (u64)msecs * NSEC_PER_MSEC);
+	preempt_enable();
+
+	return div64_u64(elapsed, pages);
+}
+
+static void __init cow_bench(void)
+{
+	unsigned int ns_int, ns_neon, ns_vfp;
+
+	ns_int = cow_speed(COW_INT);
+	ns_neon = cow_speed(COW_NEON);
+	ns_vfp = cow_speed(COW_NEON_VFP);
+
+	pr_info("cow page copy: copy_page %u ns, copy_page_neon %u ns, "
+		"%u ns with VFP state live\n", ns_int, ns_neon, ns_vfp);
+	pr_info("VFP save and reload trap: %d ns per fault, NEON copy "
+		"gains %d ns per fault\n",
+		(int)(ns_vfp - ns_neon), (int)(ns_int - ns_neon));
+}
+#endif
+
+static int __init copy_bench_init(void)
+{
+	unsigned int nr = ARRAY_SIZE(copy_routines);
+	mm_segment_t old_fs;
+	int errors = 0, i;
+
+	bench_src = vmalloc(BENCH_MAX + BENCH_SLACK);
+	bench_dst = vmalloc(BENCH_MAX + BENCH_SLACK);
+	bench_ref = vmalloc(BENCH_MAX + BENCH_SLACK);
+	if (!bench_src || !bench_dst || !bench_ref) {
+		errors = -ENOMEM;
+		goto out;
+	}
+	get_random_bytes(bench_src, BENCH_MAX + BENCH_SLACK);
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+	/* copy_page_neon() can only be selected on Cortex-A8 */
+	if (!cpu_is_cortex_a8() || !cpu_has_neon())
+		nr--;
+#endif
+	pr_info("cpu id %08x%s, %u byte lines\n", read_cpuid_id(),
+		cpu_is_cortex_a8() ? " (Cortex-A8)" : "", L1_CACHE_BYTES);
+
+	/* the user copies are run on kernel buffers */
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+
+	for (i = 0; i < nr; i++)
+		errors += copy_check(&copy_routines[i]);
+	if (errors)
+		pr_err("%d mismatches, not benchmarking\n", errors);
+	else {
+		pr_info("all copies match the byte copy\n");
+		for (i = 0; i < nr; i++)
+			copy_bench(&copy_routines[i]);
+#ifdef CONFIG_KERNEL_MODE_NEON
+		if (cpu_is_cortex_a8() && cpu_has_neon())
+			cow_bench();
+#endif
+	}
+
+	set_fs(old_fs);
+
+out:
+	vfree(bench_ref);
+	vfree(bench_dst);
+	vfree(bench_src);
+
+	/* Nothing to keep loaded; report failure so insmod can be re-run. */
+	if (errors < 0)
+		return errors;
+	return errors ? -EIO : -EAGAIN;
+}
+
+module_init(copy_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Correctness sweep and benchmark for the ARM copy routines");
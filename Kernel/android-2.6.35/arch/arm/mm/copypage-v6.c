@@ -17,6 +17,8 @@
 #include <asm/tlbflush.h>
 #include <asm/cacheflush.h>
 #include <asm/cachetype.h>
+#include <asm/cputype.h>
+#include <asm/neon.h>
 
 #include "mm.h"
 
@@ -46,6 +48,43 @@ static void v6_copy_user_highpage_nonaliasing(struct page *to,
 	kunmap_atomic(kfrom, KM_USER0);
 }
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+/*
+ * As above, but on Cortex-A8 the copy itself goes through NEON, which
+ * streams a page close to the memory bandwidth where ldm/stm does not.
+ * Page faults come in with irqs on, as kernel_neon_begin() needs.
+ *
+ * If the faulting task has VFP state live in the registers, this also
+ * saves it, and the task takes a trap to reload it on its next VFP
+ * instruction.  That can cost more than the faster copy gains, so it is
+ * only used with "copypage_neon" on the command line; copy_bench.ko
+ * measures both sides.
+ */
+static int copypage_neon __initdata;
+
+static int __init copypage_neon_setup(char *__unused)
+{
+	copypage_neon = 1;
+	return 1;
+}
+__setup("copypage_neon", copypage_neon_setup);
+
+static void v6_copy_user_highpage_neon(struct page *to,
+	struct page *from, unsigned long vaddr, struct vm_area_struct *vma)
+{
+	void *kto, *kfrom;
+
+	kfrom = kmap_atomic(from, KM_USER0);
+	kto = kmap_atomic(to, KM_USER1);
+	kernel_neon_begin();
+	copy_page_neon(kto, kfrom);
+	kernel_neon_end();
+	__cpuc_flush_dcache_area(kto, PAGE_SIZE);
+	kunmap_atomic(kto, KM_USER1);
+	kunmap_atomic(kfrom, KM_USER0);
+}
+#endif
+
 /*
  * Clear the user page.  No aliasing to deal with so we can just
  * attack the kernel's existing mapping of this page.
@@ -147,3 +186,20 @@ static int __init v6_userpage_init(void)
 }
 
 core_initcall(v6_userpage_init);
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+/*
+ * arch/arm/mm links ahead of arch/arm/vfp, so HWCAP_NEON is only known
+ * once the core_initcalls are done.
+ */
+static int __init v6_userpage_neon_init(void)
+{
+	if (copypage_neon && !cache_is_vipt_aliasing() &&
+	    cpu_is_cortex_a8() && cpu_has_neon())
+		cpu_user.cpu_copy_user_highpage = v6_copy_user_highpage_neon;
+
+	return 0;
+}
+
+arch_initcall(v6_userpage_neon_init);
+#endif
@@ -10,6 +10,8 @@
  */
 #include <linux/module.h>
 #include <linux/types.h>
+#include <linux/hardirq.h>
+#include <linux/interrupt.h>
 #include <linux/cpu.h>
 #include <linux/kernel.h>
 #include <linux/notifier.h>
@@ -19,6 +21,7 @@
 #include <linux/init.h>
 
 #include <asm/thread_notify.h>
+#include <asm/neon.h>
 #include <asm/vfp.h>
 
 #include "vfpinstr.h"
@@ -41,6 +44,27 @@ union vfp_state *last_VFP_context[NR_CPUS];
  */
 unsigned int VFP_arch;
 
+/*
+ * With kernel-mode NEON, a softirq may take over the unit whenever
+ * softirqs are enabled, so code that looks at or saves the hardware state
+ * has to keep them off rather than just disable preemption.
+ */
+#ifdef CONFIG_KERNEL_MODE_NEON
+static inline unsigned int vfp_get_cpu(void)
+{
+	local_bh_disable();
+	return smp_processor_id();
+}
+
+static inline void vfp_put_cpu(void)
+{
+	local_bh_enable();
+}
+#else
+#define vfp_get_cpu()	get_cpu()
+#define vfp_put_cpu()	put_cpu()
+#endif
+
 /*
  * Per-thread VFP initialization.
  */
@@ -59,22 +83,22 @@ static void vfp_thread_flush(struct thread_info *thread)
 	 * that the modification of last_VFP_context[] and hardware disable
 	 * are done for the same CPU and without preemption.
 	 */
-	cpu = get_cpu();
+	cpu = vfp_get_cpu();
 	if (last_VFP_context[cpu] == vfp)
 		last_VFP_context[cpu] = NULL;
 	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
-	put_cpu();
+	vfp_put_cpu();
 }
 
 static void vfp_thread_exit(struct thread_info *thread)
 {
 	/* release case: Per-thread VFP cleanup. */
 	union vfp_state *vfp = &thread->vfpstate;
-	unsigned int cpu = get_cpu();
+	unsigned int cpu = vfp_get_cpu();
 
 	if (last_VFP_context[cpu] == vfp)
 		last_VFP_context[cpu] = NULL;
-	put_cpu();
+	vfp_put_cpu();
 }
 
 /*
@@ -105,11 +129,20 @@ static int vfp_notifier(struct notifier_block *self, unsigned long cmd, void *v)
 	struct thread_info *thread = v;
 
 	if (likely(cmd == THREAD_NOTIFY_SWITCH)) {
-		u32 fpexc = fmrx(FPEXC);
-
+		u32 fpexc;
 #ifdef CONFIG_SMP
 		unsigned int cpu = thread->cpu;
+#endif
+
+		/*
+		 * Interrupts are on over the switch, so keep a softirq
+		 * kernel_neon_begin() from taking the unit between the
+		 * FPEXC read and the save below.
+		 */
+		vfp_get_cpu();
+		fpexc = fmrx(FPEXC);
 
+#ifdef CONFIG_SMP
 		/*
 		 * On SMP, if VFP is enabled, save the old state in
 		 * case the thread migrates to a different CPU. The
@@ -133,6 +166,7 @@ static int vfp_notifier(struct notifier_block *self, unsigned long cmd, void *v)
 		 * old state.
 		 */
 		fmxr(FPEXC, fpexc & ~FPEXC_EN);
+		vfp_put_cpu();
 		return NOTIFY_DONE;
 	}
 
@@ -273,6 +307,15 @@ void VFP_bounce(u32 trigger, u32 fpexc, struct pt_regs *regs)
 
 	pr_debug("VFP: bounce: trigger %08x fpexc %08x\n", trigger, fpexc);
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+	/*
+	 * do_vfp left IRQs off; the hardware holds the state being emulated
+	 * against, so keep softirqs out of the unit until we are done.
+	 */
+	local_bh_disable();
+	local_irq_enable();
+#endif
+
 	/*
 	 * At this point, FPEXC can have the following configuration:
 	 *
@@ -363,6 +406,9 @@ void VFP_bounce(u32 trigger, u32 fpexc, struct pt_regs *regs)
 	if (exceptions)
 		vfp_raise_exceptions(exceptions, trigger, orig_fpscr, regs);
  exit:
+#ifdef CONFIG_KERNEL_MODE_NEON
+	local_bh_enable();
+#endif
 	preempt_enable();
 }
 
@@ -433,7 +479,7 @@ static inline void vfp_pm_init(void) { }
 
 void vfp_sync_hwstate(struct thread_info *thread)
 {
-	unsigned int cpu = get_cpu();
+	unsigned int cpu = vfp_get_cpu();
 
 	/*
 	 * If the thread we're interested in is the current owner of the
@@ -450,12 +496,12 @@ void vfp_sync_hwstate(struct thread_info *thread)
 		fmxr(FPEXC, fpexc);
 	}
 
-	put_cpu();
+	vfp_put_cpu();
 }
 
 void vfp_flush_hwstate(struct thread_info *thread)
 {
-	unsigned int cpu = get_cpu();
+	unsigned int cpu = vfp_get_cpu();
 
 	/*
 	 * If the thread we're interested in is the current owner of the
@@ -483,9 +529,58 @@ void vfp_flush_hwstate(struct thread_info *thread)
 	 */
 	thread->vfpstate.hard.cpu = NR_CPUS;
 #endif
-	put_cpu();
+	vfp_put_cpu();
 }
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+/*
+ * Take over the VFP/NEON unit for kernel use.  Whatever user state is live
+ * in the registers is saved to its owner and the owner is forgotten, so the
+ * next user access traps and reloads it, exactly as after a context switch.
+ *
+ * Softirqs stay disabled until kernel_neon_end(): that keeps the section on
+ * this CPU, and stops a softirq from starting a section of its own on top
+ * of it.  Sections do not nest and must not sleep.
+ */
+void kernel_neon_begin(void)
+{
+	struct thread_info *thread = current_thread_info();
+	unsigned int cpu;
+	u32 fpexc;
+
+	BUG_ON(in_irq() || irqs_disabled());
+
+	cpu = vfp_get_cpu();
+
+	/* enable the unit with any pending exception masked, as entry.S does */
+	fpexc = fmrx(FPEXC) | FPEXC_EN;
+	fmxr(FPEXC, fpexc & ~FPEXC_EX);
+
+	/*
+	 * On UP the owner may be a task other than current, as its state is
+	 * only saved when someone else needs the unit.  On SMP that was done
+	 * when the owner was switched out, and it may be running elsewhere
+	 * by now, so only current's state can still be live here.
+	 */
+	if (last_VFP_context[cpu] == &thread->vfpstate)
+		vfp_save_state(&thread->vfpstate, fpexc);
+#ifndef CONFIG_SMP
+	else if (last_VFP_context[cpu])
+		vfp_save_state(last_VFP_context[cpu], fpexc);
+#endif
+	last_VFP_context[cpu] = NULL;
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	/* disable the unit so that the next user access reloads its state */
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	vfp_put_cpu();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+#endif /* CONFIG_KERNEL_MODE_NEON */
+
 #ifdef CONFIG_HOTPLUG_CPU
 static int vfp_hotplug_notifier(struct notifier_block *b, unsigned long action,
 				void *data)
@@ -577,4 +672,10 @@ static int __init vfp_init(void)
 	return 0;
 }
 
-late_initcall(vfp_init);
+/*
+ * cpu_has_neon() users such as the xor and NEON cipher code choose their
+ * implementation in their own initcalls, so HWCAP_NEON must be set first.
+ * arch/arm/vfp links ahead of crypto/, lib/ and drivers/, but after
+ * arch/arm/mm: code there has to decide later than core_initcall.
+ */
+core_initcall(vfp_init);
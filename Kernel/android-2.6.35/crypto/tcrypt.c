@@ -26,6 +26,9 @@
 #include <linux/jiffies.h>
 #include <linux/timex.h>
 #include <linux/interrupt.h>
+#include <linux/cpufreq.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include "tcrypt.h"
 #include "internal.h"
 
@@ -51,6 +54,28 @@ static u32 mask;
 static int mode;
 static char *tvmem[TVMEMSIZE];
 
+/*
+ * CPU clock in kHz when get_cycles() is a stub, as on ARM.  Cycle counts
+ * are then derived from the elapsed time, which is only exact while the
+ * clock does not change: run with the performance governor.
+ */
+static unsigned int cycles_khz;
+
+static cycles_t tcrypt_get_cycles(void)
+{
+	if (cycles_khz)
+		return (cycles_t)ktime_to_ns(ktime_get());
+	return get_cycles();
+}
+
+/* Converts a sum of tcrypt_get_cycles() differences into cycles. */
+static unsigned long tcrypt_cycles(unsigned long count)
+{
+	if (cycles_khz)
+		return div_u64((u64)count * cycles_khz, USEC_PER_SEC);
+	return count;
+}
+
 static char *check[] = {
 	"des", "md5", "des3_ede", "rot13", "sha1", "sha224", "sha256",
 	"blowfish", "twofish", "serpent", "sha384", "sha512", "md4", "aes",
@@ -90,8 +115,12 @@ static int test_cipher_cycles(struct blkcipher_desc *desc, int enc,
 	int ret = 0;
 	int i;
 
-	local_bh_disable();
-	local_irq_disable();
+	/*
+	 * Interrupts stay on: ciphers using kernel_neon_begin() fall back
+	 * to their integer code when they are off, and that is not what
+	 * would run for a real request.
+	 */
+	preempt_disable();
 
 	/* Warm-up run. */
 	for (i = 0; i < 4; i++) {
@@ -108,12 +137,12 @@ static int test_cipher_cycles(struct blkcipher_desc *desc, int enc,
 	for (i = 0; i < 8; i++) {
 		cycles_t start, end;
 
-		start = get_cycles();
+		start = tcrypt_get_cycles();
 		if (enc)
 			ret = crypto_blkcipher_encrypt(desc, sg, sg, blen);
 		else
 			ret = crypto_blkcipher_decrypt(desc, sg, sg, blen);
-		end = get_cycles();
+		end = tcrypt_get_cycles();
 
 		if (ret)
 			goto out;
@@ -122,12 +151,12 @@ static int test_cipher_cycles(struct blkcipher_desc *desc, int enc,
 	}
 
 out:
-	local_irq_enable();
-	local_bh_enable();
+	preempt_enable();
 
+	cycles = tcrypt_cycles(cycles);
 	if (ret == 0)
-		printk("1 operation in %lu cycles (%d bytes)\n",
-		       (cycles + 4) / 8, blen);
+		printk("1 operation in %lu cycles (%d bytes), %lu cycles/byte\n",
+		       (cycles + 4) / 8, blen, (cycles + 4) / (8 * blen));
 
 	return ret;
 }
@@ -306,13 +335,13 @@ static int test_hash_cycles_digest(struct hash_desc *desc,
 	for (i = 0; i < 8; i++) {
 		cycles_t start, end;
 
-		start = get_cycles();
+		start = tcrypt_get_cycles();
 
 		ret = crypto_hash_digest(desc, sg, blen, out);
 		if (ret)
 			goto out;
 
-		end = get_cycles();
+		end = tcrypt_get_cycles();
 
 		cycles += end - start;
 	}
@@ -324,6 +353,7 @@ out:
 	if (ret)
 		return ret;
 
+	cycles = tcrypt_cycles(cycles);
 	printk("%6lu cycles/operation, %4lu cycles/byte\n",
 	       cycles / 8, cycles / (8 * blen));
 
@@ -362,7 +392,7 @@ static int test_hash_cycles(struct hash_desc *desc, struct scatterlist *sg,
 	for (i = 0; i < 8; i++) {
 		cycles_t start, end;
 
-		start = get_cycles();
+		start = tcrypt_get_cycles();
 
 		ret = crypto_hash_init(desc);
 		if (ret)
@@ -376,7 +406,7 @@ static int test_hash_cycles(struct hash_desc *desc, struct scatterlist *sg,
 		if (ret)
 			goto out;
 
-		end = get_cycles();
+		end = tcrypt_get_cycles();
 
 		cycles += end - start;
 	}
@@ -388,6 +418,7 @@ out:
 	if (ret)
 		return ret;
 
+	cycles = tcrypt_cycles(cycles);
 	printk("%6lu cycles/operation, %4lu cycles/byte\n",
 	       cycles / 8, cycles / (8 * blen));
 
@@ -565,13 +596,13 @@ static int test_ahash_cycles_digest(struct ahash_request *req, int blen,
 	for (i = 0; i < 8; i++) {
 		cycles_t start, end;
 
-		start = get_cycles();
+		start = tcrypt_get_cycles();
 
 		ret = do_one_ahash_op(req, crypto_ahash_digest(req));
 		if (ret)
 			goto out;
 
-		end = get_cycles();
+		end = tcrypt_get_cycles();
 
 		cycles += end - start;
 	}
@@ -580,6 +611,7 @@ out:
 	if (ret)
 		return ret;
 
+	cycles = tcrypt_cycles(cycles);
 	pr_cont("%6lu cycles/operation, %4lu cycles/byte\n",
 		cycles / 8, cycles / (8 * blen));
 
@@ -614,7 +646,7 @@ static int test_ahash_cycles(struct ahash_request *req, int blen,
 	for (i = 0; i < 8; i++) {
 		cycles_t start, end;
 
-		start = get_cycles();
+		start = tcrypt_get_cycles();
 
 		ret = crypto_ahash_init(req);
 		if (ret)
@@ -628,7 +660,7 @@ static int test_ahash_cycles(struct ahash_request *req, int blen,
 		if (ret)
 			goto out;
 
-		end = get_cycles();
+		end = tcrypt_get_cycles();
 
 		cycles += end - start;
 	}
@@ -637,6 +669,7 @@ out:
 	if (ret)
 		return ret;
 
+	cycles = tcrypt_cycles(cycles);
 	pr_cont("%6lu cycles/operation, %4lu cycles/byte\n",
 		cycles / 8, cycles / (8 * blen));
 
@@ -1138,6 +1171,10 @@ static int do_test(int m)
 		test_hash_speed("ghash-generic", sec, hash_speed_template_16);
 		if (mode > 300 && mode < 400) break;
 
+	case 319:
+		test_hash_speed("crc32c", sec, generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
 	case 399:
 		break;
 
@@ -1240,6 +1277,13 @@ static int __init tcrypt_mod_init(void)
 			goto err_free_tv;
 	}
 
+	if (!sec && !get_cycles()) {
+		cycles_khz = cpufreq_quick_get(raw_smp_processor_id());
+		if (cycles_khz)
+			printk(KERN_INFO "tcrypt: no cycle counter, counting "
+			       "cycles at %u kHz\n", cycles_khz);
+	}
+
 	if (alg)
 		err = do_alg_test(alg, type, mask);
 	else
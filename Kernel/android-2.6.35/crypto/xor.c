@@ -18,6 +18,7 @@
 
 #define BH_TRACE 0
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/gfp.h>
 #include <linux/raid/xor.h>
 #include <linux/jiffies.h>
@@ -152,6 +153,38 @@ calibrate_xor_blocks(void)
 	return 0;
 }
 
+/*
+ * The calibration result, read-only in /sys/module/xor/parameters:
+ * "template" is the template in use and "speeds" lists every template
+ * that was measured, in MB/sec.
+ */
+static int xor_param_set(const char *val, struct kernel_param *kp)
+{
+	return -EPERM;
+}
+
+static int xor_param_get_template(char *buffer, struct kernel_param *kp)
+{
+	if (!active_template)
+		return 0;
+	return sprintf(buffer, "%s", active_template->name);
+}
+
+static int xor_param_get_speeds(char *buffer, struct kernel_param *kp)
+{
+	struct xor_block_template *f;
+	int len = 0;
+
+	for (f = template_list; f; f = f->next)
+		len += sprintf(buffer + len, "%s%-10s %5d.%03d",
+			       len ? "\n" : "", f->name,
+			       f->speed / 1000, f->speed % 1000);
+	return len;
+}
+
+module_param_call(template, xor_param_set, xor_param_get_template, NULL, 0444);
+module_param_call(speeds, xor_param_set, xor_param_get_speeds, NULL, 0444);
+
 static __exit void xor_exit(void) { }
 
 MODULE_LICENSE("GPL");
@@ -112,19 +112,22 @@ static unsigned int __cpufreq_get(unsigned int cpu);
 static void handle_update(struct work_struct *work);
 
 /**
- * Two notifier lists: the "policy" list is involved in the
+ * Three notifier lists: the "policy" list is involved in the
  * validation process for a new CPU frequency policy; the
  * "transition" list for kernel code that needs to handle
- * changes to devices when the CPU clock speed changes.
- * The mutex locks both lists.
+ * changes to devices when the CPU clock speed changes; the
+ * "target" list for statistics about each call into the driver.
+ * The mutex locks the lists.
  */
 static BLOCKING_NOTIFIER_HEAD(cpufreq_policy_notifier_list);
 static struct srcu_notifier_head cpufreq_transition_notifier_list;
+static struct srcu_notifier_head cpufreq_target_notifier_list;
 
 static bool init_cpufreq_transition_notifier_list_called;
 static int __init init_cpufreq_transition_notifier_list(void)
 {
 	srcu_init_notifier_head(&cpufreq_transition_notifier_list);
+	srcu_init_notifier_head(&cpufreq_target_notifier_list);
 	init_cpufreq_transition_notifier_list_called = true;
 	return 0;
 }
@@ -1482,12 +1485,14 @@ static struct sysdev_driver cpufreq_sysdev_driver = {
 /**
  *	cpufreq_register_notifier - register a driver with cpufreq
  *	@nb: notifier function to register
- *      @list: CPUFREQ_TRANSITION_NOTIFIER or CPUFREQ_POLICY_NOTIFIER
+ *      @list: CPUFREQ_TRANSITION_NOTIFIER, CPUFREQ_POLICY_NOTIFIER or
+ *             CPUFREQ_TARGET_NOTIFIER
  *
- *	Add a driver to one of two lists: either a list of drivers that
+ *	Add a driver to one of three lists: a list of drivers that
  *      are notified about clock rate changes (once before and once after
- *      the transition), or a list of drivers that are notified about
- *      changes in cpufreq policy.
+ *      the transition), a list of drivers that are notified about
+ *      changes in cpufreq policy, or a list of drivers that are told how
+ *      long each call into the cpufreq driver took.
  *
  *	This function may sleep, and has the same return conditions as
  *	blocking_notifier_chain_register.
@@ -1507,6 +1512,10 @@ int cpufreq_register_notifier(struct notifier_block *nb, unsigned int list)
 		ret = blocking_notifier_chain_register(
 				&cpufreq_policy_notifier_list, nb);
 		break;
+	case CPUFREQ_TARGET_NOTIFIER:
+		ret = srcu_notifier_chain_register(
+				&cpufreq_target_notifier_list, nb);
+		break;
 	default:
 		ret = -EINVAL;
 	}
@@ -1519,7 +1528,8 @@ EXPORT_SYMBOL(cpufreq_register_notifier);
 /**
  *	cpufreq_unregister_notifier - unregister a driver with cpufreq
  *	@nb: notifier block to be unregistered
- *      @list: CPUFREQ_TRANSITION_NOTIFIER or CPUFREQ_POLICY_NOTIFIER
+ *      @list: CPUFREQ_TRANSITION_NOTIFIER, CPUFREQ_POLICY_NOTIFIER or
+ *             CPUFREQ_TARGET_NOTIFIER
  *
  *	Remove a driver from the CPU frequency notifier list.
  *
@@ -1539,6 +1549,10 @@ int cpufreq_unregister_notifier(struct notifier_block *nb, unsigned int list)
 		ret = blocking_notifier_chain_unregister(
 				&cpufreq_policy_notifier_list, nb);
 		break;
+	case CPUFREQ_TARGET_NOTIFIER:
+		ret = srcu_notifier_chain_unregister(
+				&cpufreq_target_notifier_list, nb);
+		break;
 	default:
 		ret = -EINVAL;
 	}
@@ -1553,16 +1567,61 @@ EXPORT_SYMBOL(cpufreq_unregister_notifier);
  *********************************************************************/
 
 
+/**
+ * cpufreq_governor_sample - note the start of a governor sample
+ * @policy: policy whose load is about to be evaluated
+ *
+ * The next __cpufreq_driver_target() call on @policy reports the time
+ * since this call as the governor's decision latency.
+ */
+void cpufreq_governor_sample(struct cpufreq_policy *policy)
+{
+	policy->sample_time = ktime_get();
+}
+EXPORT_SYMBOL_GPL(cpufreq_governor_sample);
+
+/**
+ * cpufreq_governor_sample_end - note the end of a governor sample
+ * @policy: policy whose load was evaluated
+ *
+ * Drops the stamp of a sample that did not lead to a target call, so
+ * that a later unrelated __cpufreq_driver_target() does not report it.
+ */
+void cpufreq_governor_sample_end(struct cpufreq_policy *policy)
+{
+	policy->sample_time = ktime_set(0, 0);
+}
+EXPORT_SYMBOL_GPL(cpufreq_governor_sample_end);
+
 int __cpufreq_driver_target(struct cpufreq_policy *policy,
 			    unsigned int target_freq,
 			    unsigned int relation)
 {
+	struct cpufreq_target_times times;
+	ktime_t start, sample;
 	int retval = -EINVAL;
 
 	dprintk("target for CPU %u: %u kHz, relation %u\n", policy->cpu,
 		target_freq, relation);
-	if (cpu_online(policy->cpu) && cpufreq_driver->target)
-		retval = cpufreq_driver->target(policy, target_freq, relation);
+	if (!cpu_online(policy->cpu) || !cpufreq_driver->target)
+		return retval;
+
+	/* a sample only accounts for the first target call it leads to */
+	sample = policy->sample_time;
+	policy->sample_time = ktime_set(0, 0);
+
+	times.old = policy->cur;
+	start = ktime_get();
+	retval = cpufreq_driver->target(policy, target_freq, relation);
+	if (retval)
+		return retval;
+
+	times.transition_us = ktime_us_delta(ktime_get(), start);
+	times.decision_us = sample.tv64 ? ktime_us_delta(start, sample) : -1;
+	times.cpu = policy->cpu;
+	times.new = policy->cur;
+	srcu_notifier_call_chain(&cpufreq_target_notifier_list,
+			CPUFREQ_TARGETDONE, &times);
 
 	return retval;
 }
@@ -435,6 +435,7 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	unsigned int j;
 
 	policy = this_dbs_info->cur_policy;
+	cpufreq_governor_sample(policy);
 
 	/*
 	 * Every sampling_rate, we check, if current idle time is less
@@ -559,6 +560,7 @@ static void do_dbs_timer(struct work_struct *work)
 	mutex_lock(&dbs_info->timer_mutex);
 
 	dbs_check_cpu(dbs_info);
+	cpufreq_governor_sample_end(dbs_info->cur_policy);
 
 	queue_delayed_work_on(cpu, kconservative_wq, &dbs_info->work, delay);
 	mutex_unlock(&dbs_info->timer_mutex);
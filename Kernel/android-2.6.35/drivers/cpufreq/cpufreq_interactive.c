@@ -0,0 +1,642 @@
+/*
+ *  drivers/cpufreq/cpufreq_interactive.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The interactive governor samples load from a short per-CPU timer that
+ * only runs while the CPU is busy or above its minimum speed, so a CPU
+ * coming out of idle is re-evaluated within one timer period instead of
+ * waiting for the next ondemand sample. Heavy load jumps straight to
+ * hispeed_freq, input events boost to hispeed_freq ahead of the load,
+ * and speed is only lowered once the previous choice has been held for
+ * min_sample_time.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/input.h>
+#include <linux/jiffies.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/tick.h>
+#include <linux/timer.h>
+
+/* Go to hispeed_freq when CPU load at or above this value. */
+#define DEFAULT_GO_HISPEED_LOAD		85
+/* Minimum time, in uS, a speed must be held before it is lowered. */
+#define DEFAULT_MIN_SAMPLE_TIME		(80 * USEC_PER_MSEC)
+/* Sampling period, in uS, while the CPU is not idle at minimum speed. */
+#define DEFAULT_TIMER_RATE		(20 * USEC_PER_MSEC)
+/* How long, in uS, an input event holds the speed at hispeed_freq. */
+#define DEFAULT_INPUT_BOOST_DURATION	(80 * USEC_PER_MSEC)
+
+static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
+					unsigned int event);
+static int cpufreq_interactive_boost_policy(struct cpufreq_policy *policy);
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
+static
+#endif
+struct cpufreq_governor cpufreq_gov_interactive = {
+	.name			= "interactive",
+	.governor		= cpufreq_governor_interactive,
+	.max_transition_latency	= 10000000,
+	.owner			= THIS_MODULE,
+	.boost_cpu_freq		= cpufreq_interactive_boost_policy,
+};
+
+struct cpufreq_interactive_cpuinfo {
+	struct timer_list cpu_timer;
+	u64 time_in_idle;
+	u64 time_in_idle_timestamp;
+	struct cpufreq_policy *policy;
+	struct cpufreq_frequency_table *freq_table;
+	unsigned int target_freq;
+	unsigned int floor_freq;
+	u64 floor_validate_time;
+	int governor_enabled;
+};
+
+static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
+
+/* realtime thread that applies the speeds chosen by the timers */
+static struct task_struct *speedchange_task;
+static cpumask_t speedchange_cpumask;
+static DEFINE_SPINLOCK(speedchange_cpumask_lock);
+
+/*
+ * Serializes governor start/stop/limits with the speed change thread.  The
+ * sysfs store handlers must not take it: GOV_STOP removes their group with
+ * it held, which waits for writers in progress.
+ */
+static DEFINE_MUTEX(interactive_mutex);
+static int active_count;
+
+/* the idle routine that was installed before this governor started */
+static void (*pm_idle_old)(void);
+
+/* Tunables; each is one word, written by sysfs and read without locking */
+static struct interactive_tuners {
+	unsigned int hispeed_freq;
+	unsigned int go_hispeed_load;
+	unsigned int min_sample_time;
+	unsigned int timer_rate;
+	unsigned int input_boost;
+	unsigned int input_boost_duration;
+} tuners_ins = {
+	.go_hispeed_load = DEFAULT_GO_HISPEED_LOAD,
+	.min_sample_time = DEFAULT_MIN_SAMPLE_TIME,
+	.timer_rate = DEFAULT_TIMER_RATE,
+	.input_boost = 1,
+	.input_boost_duration = DEFAULT_INPUT_BOOST_DURATION,
+};
+
+/* input boost stays in effect until this time, in jiffies */
+static unsigned long boost_end;
+
+static u64 interactive_time_us(void)
+{
+	return ktime_to_us(ktime_get());
+}
+
+static void cpufreq_interactive_timer_resched(
+	struct cpufreq_interactive_cpuinfo *pcpu, int cpu)
+{
+	pcpu->time_in_idle = get_cpu_idle_time_us(cpu,
+						  &pcpu->time_in_idle_timestamp);
+	mod_timer_pinned(&pcpu->cpu_timer,
+			 jiffies + usecs_to_jiffies(tuners_ins.timer_rate));
+}
+
+static void cpufreq_interactive_speedchange(
+	struct cpufreq_interactive_cpuinfo *pcpu, int cpu,
+	unsigned int new_freq)
+{
+	unsigned long flags;
+
+	pcpu->target_freq = new_freq;
+	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+	cpumask_set_cpu(cpu, &speedchange_cpumask);
+	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+	wake_up_process(speedchange_task);
+}
+
+static void cpufreq_interactive_timer(unsigned long data)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, data);
+	u64 now, now_idle, delta_idle, delta_time;
+	unsigned int load, new_freq, index;
+	int boosted;
+
+	if (!pcpu->governor_enabled)
+		return;
+
+	cpufreq_governor_sample(pcpu->policy);
+	now_idle = get_cpu_idle_time_us(data, &now);
+	delta_idle = now_idle - pcpu->time_in_idle;
+	delta_time = now - pcpu->time_in_idle_timestamp;
+
+	/* a zero or backwards sample tells us nothing, try again */
+	if (!delta_time || delta_time < delta_idle)
+		goto rearm;
+
+	load = div64_u64(100 * (delta_time - delta_idle), delta_time);
+	boosted = tuners_ins.input_boost && time_before(jiffies, boost_end);
+
+	if (load >= tuners_ins.go_hispeed_load || boosted) {
+		if (pcpu->target_freq < tuners_ins.hispeed_freq)
+			new_freq = tuners_ins.hispeed_freq;
+		else
+			new_freq = max(tuners_ins.hispeed_freq,
+				       pcpu->policy->max * load / 100);
+	} else {
+		new_freq = pcpu->policy->max * load / 100;
+	}
+
+	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
+					   new_freq, CPUFREQ_RELATION_H,
+					   &index))
+		goto rearm;
+	new_freq = pcpu->freq_table[index].frequency;
+
+	/*
+	 * Hysteresis: do not drop below the last speed chosen until it has
+	 * been held for min_sample_time.
+	 */
+	now = interactive_time_us();
+	if (new_freq < pcpu->floor_freq &&
+	    now - pcpu->floor_validate_time < tuners_ins.min_sample_time)
+		goto rearm;
+
+	pcpu->floor_freq = new_freq;
+	pcpu->floor_validate_time = now;
+
+	if (pcpu->target_freq != new_freq) {
+		/* the speedchange task ends the sample with its target call */
+		cpufreq_interactive_speedchange(pcpu, data, new_freq);
+		goto rearm_changing;
+	}
+
+rearm:
+	cpufreq_governor_sample_end(pcpu->policy);
+rearm_changing:
+	/*
+	 * An idle CPU at minimum speed has nothing to lower; it is sampled
+	 * again when it leaves idle.
+	 */
+	if (!timer_pending(&pcpu->cpu_timer) &&
+	    !(idle_cpu(data) && pcpu->target_freq == pcpu->policy->min))
+		cpufreq_interactive_timer_resched(pcpu, data);
+}
+
+/* Called with interrupts disabled, like every pm_idle routine. */
+static void cpufreq_interactive_idle(void)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, smp_processor_id());
+	int cpu = smp_processor_id();
+
+	if (!pcpu->governor_enabled) {
+		pm_idle_old();
+		return;
+	}
+
+	/* keep sampling while idle above minimum speed so we slow down */
+	if (pcpu->target_freq != pcpu->policy->min &&
+	    !timer_pending(&pcpu->cpu_timer))
+		cpufreq_interactive_timer_resched(pcpu, cpu);
+
+	pm_idle_old();
+
+	/* idle exit: evaluate the new load one timer period from now */
+	if (!timer_pending(&pcpu->cpu_timer))
+		cpufreq_interactive_timer_resched(pcpu, cpu);
+}
+
+static int cpufreq_interactive_speedchange_task(void *data)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int cpu, j, max_freq;
+	cpumask_t tmp_mask;
+	unsigned long flags;
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+
+		if (cpumask_empty(&speedchange_cpumask)) {
+			spin_unlock_irqrestore(&speedchange_cpumask_lock,
+					       flags);
+			schedule();
+
+			if (kthread_should_stop())
+				break;
+
+			spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+		}
+
+		set_current_state(TASK_RUNNING);
+		cpumask_copy(&tmp_mask, &speedchange_cpumask);
+		cpumask_clear(&speedchange_cpumask);
+		spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+
+		mutex_lock(&interactive_mutex);
+		for_each_cpu(cpu, &tmp_mask) {
+			pcpu = &per_cpu(cpuinfo, cpu);
+			if (!pcpu->governor_enabled)
+				continue;
+
+			/* CPUs sharing a clock run at the fastest choice */
+			max_freq = 0;
+			for_each_cpu(j, pcpu->policy->cpus) {
+				struct cpufreq_interactive_cpuinfo *pjcpu =
+					&per_cpu(cpuinfo, j);
+
+				if (pjcpu->governor_enabled &&
+				    pjcpu->target_freq > max_freq)
+					max_freq = pjcpu->target_freq;
+			}
+
+			if (max_freq != pcpu->policy->cur)
+				__cpufreq_driver_target(pcpu->policy,
+							max_freq,
+							CPUFREQ_RELATION_H);
+		}
+		mutex_unlock(&interactive_mutex);
+	}
+
+	return 0;
+}
+
+/* Raise every CPU below hispeed_freq to it; safe in atomic context. */
+static void cpufreq_interactive_boost(void)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned long flags;
+	int cpu, wake = 0;
+	u64 now = interactive_time_us();
+
+	boost_end = jiffies + usecs_to_jiffies(tuners_ins.input_boost_duration);
+
+	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		if (!pcpu->governor_enabled)
+			continue;
+
+		if (pcpu->target_freq < tuners_ins.hispeed_freq) {
+			pcpu->target_freq = tuners_ins.hispeed_freq;
+			cpumask_set_cpu(cpu, &speedchange_cpumask);
+			wake = 1;
+		}
+
+		/* hold the boost for at least min_sample_time */
+		pcpu->floor_freq = max(pcpu->floor_freq, tuners_ins.hispeed_freq);
+		pcpu->floor_validate_time = now;
+	}
+	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+
+	if (wake)
+		wake_up_process(speedchange_task);
+}
+
+static int cpufreq_interactive_boost_policy(struct cpufreq_policy *policy)
+{
+	cpufreq_interactive_boost();
+	return 0;
+}
+
+/*
+ * Input boost. Touchscreens (such as the EETI controller) and keypads
+ * (such as the TWL4030 keypad) raise the speed as soon as the user
+ * touches the device, before the resulting work shows up as load.
+ * Only a key or button press and the first frame of a multi-touch
+ * contact boost; moving a finger or a sensor streaming EV_ABS does not.
+ */
+struct cpufreq_interactive_input {
+	struct input_handle handle;
+	bool touching;		/* last multi-touch frame had a contact */
+	bool contact;		/* the frame being reported has one */
+};
+
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+					    unsigned int type,
+					    unsigned int code, int value)
+{
+	struct cpufreq_interactive_input *input =
+		container_of(handle, struct cpufreq_interactive_input, handle);
+
+	if (!tuners_ins.input_boost)
+		return;
+
+	switch (type) {
+	case EV_KEY:
+		if (value == 1)
+			cpufreq_interactive_boost();
+		break;
+	case EV_ABS:
+		/* without a touch size, every reported position is a contact */
+		if (code == ABS_MT_TOUCH_MAJOR ? value > 0 :
+		    code == ABS_MT_POSITION_X &&
+		    !test_bit(ABS_MT_TOUCH_MAJOR, handle->dev->absbit))
+			input->contact = true;
+		break;
+	case EV_SYN:
+		if (code != SYN_REPORT)
+			break;
+		if (input->contact && !input->touching)
+			cpufreq_interactive_boost();
+		input->touching = input->contact;
+		input->contact = false;
+		break;
+	}
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+					     struct input_dev *dev,
+					     const struct input_device_id *id)
+{
+	struct cpufreq_interactive_input *input;
+	struct input_handle *handle;
+	int error;
+
+	input = kzalloc(sizeof(*input), GFP_KERNEL);
+	if (!input)
+		return -ENOMEM;
+
+	handle = &input->handle;
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err_register;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err_open;
+
+	return 0;
+
+err_open:
+	input_unregister_handle(handle);
+err_register:
+	kfree(input);
+	return error;
+}
+
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(container_of(handle, struct cpufreq_interactive_input, handle));
+}
+
+/*
+ * Sensors such as the ADXL345 also report ABS_X/ABS_Y, so touchscreens
+ * are told apart by their touch button or multi-touch axes, and keys by
+ * the keys a user presses rather than by EV_KEY alone.
+ */
+#define INPUT_KEY_ID(key) {						\
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |			\
+			 INPUT_DEVICE_ID_MATCH_KEYBIT,			\
+		.evbit = { BIT_MASK(EV_KEY) },				\
+		.keybit = { [BIT_WORD(key)] = BIT_MASK(key) },		\
+	}
+
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	/* single-touch touchscreens and pen tablets */
+	INPUT_KEY_ID(BTN_TOUCH),
+	INPUT_KEY_ID(BTN_TOOL_PEN),
+	INPUT_KEY_ID(BTN_TOOL_FINGER),
+	{	/* multi-touch touchscreens */
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	},
+	/* keypads and buttons */
+	INPUT_KEY_ID(KEY_HOME),
+	INPUT_KEY_ID(KEY_MENU),
+	INPUT_KEY_ID(KEY_VOLUMEUP),
+	INPUT_KEY_ID(KEY_POWER),
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_ids,
+};
+
+/* cpufreq_interactive Governor Tunables */
+#define show_one(file_name)						\
+static ssize_t show_##file_name						\
+(struct kobject *kobj, struct attribute *attr, char *buf)		\
+{									\
+	return sprintf(buf, "%u\n", tuners_ins.file_name);			\
+}
+
+#define store_one(file_name, min_value)					\
+static ssize_t store_##file_name					\
+(struct kobject *a, struct attribute *b, const char *buf, size_t count)	\
+{									\
+	unsigned int input;						\
+									\
+	if (sscanf(buf, "%u", &input) != 1 || input < (min_value))	\
+		return -EINVAL;						\
+	tuners_ins.file_name = input;					\
+	return count;							\
+}
+
+show_one(hispeed_freq);
+show_one(go_hispeed_load);
+show_one(min_sample_time);
+show_one(timer_rate);
+show_one(input_boost);
+show_one(input_boost_duration);
+store_one(hispeed_freq, 0);
+store_one(go_hispeed_load, 1);
+store_one(min_sample_time, 0);
+store_one(timer_rate, 1000);
+store_one(input_boost, 0);
+store_one(input_boost_duration, 0);
+
+define_one_global_rw(hispeed_freq);
+define_one_global_rw(go_hispeed_load);
+define_one_global_rw(min_sample_time);
+define_one_global_rw(timer_rate);
+define_one_global_rw(input_boost);
+define_one_global_rw(input_boost_duration);
+
+static struct attribute *interactive_attributes[] = {
+	&hispeed_freq.attr,
+	&go_hispeed_load.attr,
+	&min_sample_time.attr,
+	&timer_rate.attr,
+	&input_boost.attr,
+	&input_boost_duration.attr,
+	NULL
+};
+
+static struct attribute_group interactive_attr_group = {
+	.attrs = interactive_attributes,
+	.name = "interactive",
+};
+
+static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
+					unsigned int event)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	struct cpufreq_frequency_table *freq_table;
+	unsigned int j;
+	int rc;
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if (!cpu_online(policy->cpu))
+			return -EINVAL;
+
+		freq_table = cpufreq_frequency_get_table(policy->cpu);
+		if (!freq_table)
+			return -EINVAL;
+
+		mutex_lock(&interactive_mutex);
+		if (!active_count) {
+			rc = sysfs_create_group(cpufreq_global_kobject,
+						&interactive_attr_group);
+			if (rc) {
+				mutex_unlock(&interactive_mutex);
+				return rc;
+			}
+
+			rc = input_register_handler(
+				&cpufreq_interactive_input_handler);
+			if (rc)
+				pr_warning("cpufreq_interactive: no input "
+					   "boost, error %d\n", rc);
+
+			if (!tuners_ins.hispeed_freq)
+				tuners_ins.hispeed_freq = policy->max;
+
+			pm_idle_old = pm_idle;
+			pm_idle = cpufreq_interactive_idle;
+			cpu_idle_wait();
+		}
+		active_count++;
+
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->policy = policy;
+			pcpu->freq_table = freq_table;
+			pcpu->target_freq = policy->cur;
+			pcpu->floor_freq = pcpu->target_freq;
+			pcpu->floor_validate_time = interactive_time_us();
+			pcpu->governor_enabled = 1;
+			smp_wmb();
+			if (cpu_online(j))
+				cpufreq_interactive_timer_resched(pcpu, j);
+		}
+		mutex_unlock(&interactive_mutex);
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		mutex_lock(&interactive_mutex);
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->governor_enabled = 0;
+			smp_wmb();
+			del_timer_sync(&pcpu->cpu_timer);
+		}
+
+		if (!--active_count) {
+			pm_idle = pm_idle_old;
+			cpu_idle_wait();
+			input_unregister_handler(
+				&cpufreq_interactive_input_handler);
+			sysfs_remove_group(cpufreq_global_kobject,
+					   &interactive_attr_group);
+		}
+		mutex_unlock(&interactive_mutex);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		mutex_lock(&interactive_mutex);
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy, policy->max,
+						CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy, policy->min,
+						CPUFREQ_RELATION_L);
+		for_each_cpu(j, policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->target_freq = clamp(pcpu->target_freq,
+						  policy->min, policy->max);
+		}
+		mutex_unlock(&interactive_mutex);
+		break;
+	}
+	return 0;
+}
+
+static int __init cpufreq_interactive_init(void)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO - 1 };
+	unsigned int i;
+
+	for_each_possible_cpu(i) {
+		struct cpufreq_interactive_cpuinfo *pcpu =
+			&per_cpu(cpuinfo, i);
+
+		init_timer(&pcpu->cpu_timer);
+		pcpu->cpu_timer.function = cpufreq_interactive_timer;
+		pcpu->cpu_timer.data = i;
+	}
+
+	speedchange_task = kthread_create(cpufreq_interactive_speedchange_task,
+					  NULL, "cfinteractive");
+	if (IS_ERR(speedchange_task))
+		return PTR_ERR(speedchange_task);
+
+	sched_setscheduler(speedchange_task, SCHED_FIFO, &param);
+	get_task_struct(speedchange_task);
+
+	/* start the thread so it sleeps until the first speed change */
+	wake_up_process(speedchange_task);
+
+	return cpufreq_register_governor(&cpufreq_gov_interactive);
+}
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
+fs_initcall(cpufreq_interactive_init);
+#else
+module_init(cpufreq_interactive_init);
+#endif
+
+static void __exit cpufreq_interactive_exit(void)
+{
+	cpufreq_unregister_governor(&cpufreq_gov_interactive);
+	kthread_stop(speedchange_task);
+	put_task_struct(speedchange_task);
+}
+
+module_exit(cpufreq_interactive_exit);
+
+MODULE_DESCRIPTION("'cpufreq_interactive' - A cpufreq governor for "
+	"latency sensitive workloads");
+MODULE_LICENSE("GPL");
@@ -496,6 +496,7 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 
 	this_dbs_info->freq_lo = 0;
 	policy = this_dbs_info->cur_policy;
+	cpufreq_governor_sample(policy);
 
 	/*
 	 * Every sampling_rate, we check, if current idle time is less
@@ -654,6 +655,7 @@ static void do_dbs_timer(struct work_struct *work)
 		if (!dbs_tuners_ins.powersave_bias ||
 		    sample_type == DBS_NORMAL_SAMPLE) {
 			dbs_check_cpu(dbs_info);
+			cpufreq_governor_sample_end(dbs_info->cur_policy);
 			if (dbs_info->freq_lo) {
 				/* Setup timer for SUB_SAMPLE */
 				dbs_info->sample_type = DBS_SUB_SAMPLE;
@@ -20,6 +20,8 @@
 #include <linux/kobject.h>
 #include <linux/spinlock.h>
 #include <linux/notifier.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
 #include <asm/cputime.h>
 
 static spinlock_t cpufreq_stats_lock;
@@ -30,6 +32,12 @@ static struct freq_attr _attr_##_name = {\
 	.show = _show,\
 };
 
+/*
+ * Histogram bucket i counts values below 2^i units; the last bucket
+ * collects everything from 2^(CPUFREQ_STATS_HIST_BUCKETS - 2) up.
+ */
+#define CPUFREQ_STATS_HIST_BUCKETS	16
+
 struct cpufreq_stats {
 	unsigned int cpu;
 	unsigned int total_trans;
@@ -41,6 +49,10 @@ struct cpufreq_stats {
 	unsigned int *freq_table;
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	unsigned int *trans_table;
+	ktime_t state_start;
+	unsigned int *residency_hist;	/* per state, in ms */
+	unsigned int *transition_hist;	/* per target state, in us */
+	unsigned int decision_hist[CPUFREQ_STATS_HIST_BUCKETS];	/* in us */
 #endif
 };
 
@@ -138,6 +150,82 @@ static ssize_t show_trans_table(struct cpufreq_policy *policy, char *buf)
 	return len;
 }
 CPUFREQ_STATDEVICE_ATTR(trans_table, 0444, show_trans_table);
+
+static unsigned int cpufreq_stats_bucket(s64 val)
+{
+	if (val < 1)
+		return 0;
+	if (val >= 1 << (CPUFREQ_STATS_HIST_BUCKETS - 2))
+		return CPUFREQ_STATS_HIST_BUCKETS - 1;
+	return fls(val);
+}
+
+static ssize_t show_hist_header(char *buf, ssize_t len, const char *unit)
+{
+	int i;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len, "%9s: ", unit);
+	for (i = 0; i < CPUFREQ_STATS_HIST_BUCKETS - 1; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%9u ", 1U << i);
+	len += scnprintf(buf + len, PAGE_SIZE - len, "%9s\n", "inf");
+	return len;
+}
+
+static ssize_t show_hist_row(char *buf, ssize_t len, unsigned int freq,
+			     unsigned int *hist)
+{
+	int i;
+
+	if (freq)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%9u: ", freq);
+	else
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%9s: ", "all");
+	for (i = 0; i < CPUFREQ_STATS_HIST_BUCKETS; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%9u ", hist[i]);
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	return len;
+}
+
+static ssize_t show_residency_hist(struct cpufreq_policy *policy, char *buf)
+{
+	ssize_t len;
+	int i;
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	len = show_hist_header(buf, 0, "ms");
+	for (i = 0; i < stat->state_num; i++)
+		len = show_hist_row(buf, len, stat->freq_table[i],
+			stat->residency_hist + i * CPUFREQ_STATS_HIST_BUCKETS);
+	return len;
+}
+CPUFREQ_STATDEVICE_ATTR(residency_hist, 0444, show_residency_hist);
+
+static ssize_t show_transition_hist(struct cpufreq_policy *policy, char *buf)
+{
+	ssize_t len;
+	int i;
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	len = show_hist_header(buf, 0, "us");
+	for (i = 0; i < stat->state_num; i++)
+		len = show_hist_row(buf, len, stat->freq_table[i],
+			stat->transition_hist + i * CPUFREQ_STATS_HIST_BUCKETS);
+	return len;
+}
+CPUFREQ_STATDEVICE_ATTR(transition_hist, 0444, show_transition_hist);
+
+static ssize_t show_decision_hist(struct cpufreq_policy *policy, char *buf)
+{
+	ssize_t len;
+	struct cpufreq_stats *stat = per_cpu(cpufreq_stats_table, policy->cpu);
+	if (!stat)
+		return 0;
+	len = show_hist_header(buf, 0, "us");
+	return show_hist_row(buf, len, 0, stat->decision_hist);
+}
+CPUFREQ_STATDEVICE_ATTR(decision_hist, 0444, show_decision_hist);
 #endif
 
 CPUFREQ_STATDEVICE_ATTR(total_trans, 0444, show_total_trans);
@@ -148,6 +236,9 @@ static struct attribute *default_attrs[] = {
 	&_attr_time_in_state.attr,
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	&_attr_trans_table.attr,
+	&_attr_residency_hist.attr,
+	&_attr_transition_hist.attr,
+	&_attr_decision_hist.attr,
 #endif
 	NULL
 };
@@ -218,6 +309,7 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	alloc_size += count * count * sizeof(int);
+	alloc_size += 2 * count * CPUFREQ_STATS_HIST_BUCKETS * sizeof(int);
 #endif
 	stat->max_state = count;
 	stat->time_in_state = kzalloc(alloc_size, GFP_KERNEL);
@@ -229,6 +321,9 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	stat->trans_table = stat->freq_table + count;
+	stat->residency_hist = stat->trans_table + count * count;
+	stat->transition_hist = stat->residency_hist +
+		count * CPUFREQ_STATS_HIST_BUCKETS;
 #endif
 	j = 0;
 	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
@@ -242,6 +337,9 @@ static int cpufreq_stats_create_table(struct cpufreq_policy *policy,
 	spin_lock(&cpufreq_stats_lock);
 	stat->last_time = get_jiffies_64();
 	stat->last_index = freq_table_get_index(stat, policy->cur);
+#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
+	stat->state_start = ktime_get();
+#endif
 	spin_unlock(&cpufreq_stats_lock);
 	cpufreq_cpu_put(data);
 	return 0;
@@ -277,6 +375,9 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 	struct cpufreq_freqs *freq = data;
 	struct cpufreq_stats *stat;
 	int old_index, new_index;
+#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
+	ktime_t now;
+#endif
 
 	if (val != CPUFREQ_POSTCHANGE)
 		return 0;
@@ -299,12 +400,43 @@ static int cpufreq_stat_notifier_trans(struct notifier_block *nb,
 	stat->last_index = new_index;
 #ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	stat->trans_table[old_index * stat->max_state + new_index]++;
+	now = ktime_get();
+	stat->residency_hist[old_index * CPUFREQ_STATS_HIST_BUCKETS +
+		cpufreq_stats_bucket(div_s64(ktime_us_delta(now,
+				stat->state_start), USEC_PER_MSEC))]++;
+	stat->state_start = now;
 #endif
 	stat->total_trans++;
 	spin_unlock(&cpufreq_stats_lock);
 	return 0;
 }
 
+#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
+static int cpufreq_stat_notifier_target(struct notifier_block *nb,
+		unsigned long val, void *data)
+{
+	struct cpufreq_target_times *times = data;
+	struct cpufreq_stats *stat;
+	int index;
+
+	stat = per_cpu(cpufreq_stats_table, times->cpu);
+	if (!stat)
+		return 0;
+
+	index = freq_table_get_index(stat, times->new);
+
+	spin_lock(&cpufreq_stats_lock);
+	if (times->decision_us >= 0)
+		stat->decision_hist[cpufreq_stats_bucket(times->decision_us)]++;
+	/* calls that left the frequency alone did not transition */
+	if (times->old != times->new && index != -1)
+		stat->transition_hist[index * CPUFREQ_STATS_HIST_BUCKETS +
+			cpufreq_stats_bucket(times->transition_us)]++;
+	spin_unlock(&cpufreq_stats_lock);
+	return 0;
+}
+#endif
+
 static int __cpuinit cpufreq_stat_cpu_callback(struct notifier_block *nfb,
 					       unsigned long action,
 					       void *hcpu)
@@ -337,6 +469,12 @@ static struct notifier_block notifier_trans_block = {
 	.notifier_call = cpufreq_stat_notifier_trans
 };
 
+#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
+static struct notifier_block notifier_target_block = {
+	.notifier_call = cpufreq_stat_notifier_target
+};
+#endif
+
 static int __init cpufreq_stats_init(void)
 {
 	int ret;
@@ -356,6 +494,18 @@ static int __init cpufreq_stats_init(void)
 		return ret;
 	}
 
+#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
+	ret = cpufreq_register_notifier(&notifier_target_block,
+				CPUFREQ_TARGET_NOTIFIER);
+	if (ret) {
+		cpufreq_unregister_notifier(&notifier_trans_block,
+				CPUFREQ_TRANSITION_NOTIFIER);
+		cpufreq_unregister_notifier(&notifier_policy_block,
+				CPUFREQ_POLICY_NOTIFIER);
+		return ret;
+	}
+#endif
+
 	register_hotcpu_notifier(&cpufreq_stat_cpu_notifier);
 	for_each_online_cpu(cpu) {
 		cpufreq_update_policy(cpu);
@@ -370,6 +520,10 @@ static void __exit cpufreq_stats_exit(void)
 			CPUFREQ_POLICY_NOTIFIER);
 	cpufreq_unregister_notifier(&notifier_trans_block,
 			CPUFREQ_TRANSITION_NOTIFIER);
+#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
+	cpufreq_unregister_notifier(&notifier_target_block,
+			CPUFREQ_TARGET_NOTIFIER);
+#endif
 	unregister_hotcpu_notifier(&cpufreq_stat_cpu_notifier);
 	for_each_online_cpu(cpu) {
 		cpufreq_stats_free_table(cpu);
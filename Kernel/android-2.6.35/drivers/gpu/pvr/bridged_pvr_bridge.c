@@ -4566,6 +4566,18 @@ CommonBridgeInit(IMG_VOID)
     SetDispatchTableEntry(PVRSRV_BRIDGE_ALLOC_SYNC_INFO, PVRSRVAllocSyncInfoBW);
     SetDispatchTableEntry(PVRSRV_BRIDGE_FREE_SYNC_INFO, PVRSRVFreeSyncInfoBW);
 
+#if defined(__linux__)
+    
+    SetDispatchTableEntryUnlocked(PVRSRV_BRIDGE_EVENT_OBJECT_WAIT);
+#if !defined(PDUMP)
+    
+    SetDispatchTableEntryUnlocked(PVRSRV_BRIDGE_SYNC_OPS_TAKE_TOKEN);
+    SetDispatchTableEntryUnlocked(PVRSRV_BRIDGE_SYNC_OPS_FLUSH_TO_TOKEN);
+    SetDispatchTableEntryUnlocked(PVRSRV_BRIDGE_SYNC_OPS_FLUSH_TO_MOD_OBJ);
+    SetDispatchTableEntryUnlocked(PVRSRV_BRIDGE_SYNC_OPS_FLUSH_TO_DELTA);
+#endif
+#endif
+
 #if defined (SUPPORT_SGX)
     SetSGXDispatchTableEntry();
 #endif
@@ -4597,6 +4609,16 @@ CommonBridgeInit(IMG_VOID)
     return PVRSRV_OK;
 }
 
+IMG_BOOL BridgedCallIsUnlocked(IMG_UINT32 ui32BridgeID)
+{
+    if(ui32BridgeID >= BRIDGE_DISPATCH_TABLE_ENTRY_COUNT)
+    {
+        return IMG_FALSE;
+    }
+
+    return g_BridgeDispatchTable[ui32BridgeID].bUnlocked;
+}
+
 IMG_INT BridgedDispatchKM(PVRSRV_PER_PROCESS_DATA * psPerProc,
                       PVRSRV_BRIDGE_PACKAGE   * psBridgePackageKM)
 {
@@ -4606,6 +4628,10 @@ IMG_INT BridgedDispatchKM(PVRSRV_PER_PROCESS_DATA * psPerProc,
     BridgeWrapperFunction pfBridgeHandler;
     IMG_UINT32   ui32BridgeID = psBridgePackageKM->ui32BridgeID;
     IMG_INT      err          = -EFAULT;
+#if defined(__linux__)
+    IMG_UINT32   aui32UnlockedBridgeIn[PVRSRV_MAX_UNLOCKED_BRIDGE_IN_SIZE / sizeof(IMG_UINT32)];
+    IMG_UINT32   aui32UnlockedBridgeOut[PVRSRV_MAX_UNLOCKED_BRIDGE_OUT_SIZE / sizeof(IMG_UINT32)];
+#endif
 
 #if defined(DEBUG_TRACE_BRIDGE_KM)
     PVR_DPF((PVR_DBG_ERROR, "%s: %s",
@@ -4663,17 +4689,35 @@ IMG_INT BridgedDispatchKM(PVRSRV_PER_PROCESS_DATA * psPerProc,
         
         SYS_DATA *psSysData;
 
-        SysAcquireData(&psSysData);
+        if(BridgedCallIsUnlocked(ui32BridgeID))
+        {
+            /* The shared buffer belongs to whoever holds gPVRSRVLock. */
+            if(psBridgePackageKM->ui32InBufferSize > sizeof(aui32UnlockedBridgeIn) ||
+               psBridgePackageKM->ui32OutBufferSize > sizeof(aui32UnlockedBridgeOut))
+            {
+                PVR_DPF((PVR_DBG_ERROR, "%s: Parameters too large for unlocked call %u",
+                         __FUNCTION__, ui32BridgeID));
+                goto return_fault;
+            }
 
-        
-        psBridgeIn = ((ENV_DATA *)psSysData->pvEnvSpecificData)->pvBridgeData;
-        psBridgeOut = (IMG_PVOID)((IMG_PBYTE)psBridgeIn + PVRSRV_MAX_BRIDGE_IN_SIZE);
+            psBridgeIn = aui32UnlockedBridgeIn;
+            psBridgeOut = aui32UnlockedBridgeOut;
+            OSMemSet(aui32UnlockedBridgeOut, 0, sizeof(aui32UnlockedBridgeOut));
+        }
+        else
+        {
+            SysAcquireData(&psSysData);
 
-        
+            
+            psBridgeIn = ((ENV_DATA *)psSysData->pvEnvSpecificData)->pvBridgeData;
+            psBridgeOut = (IMG_PVOID)((IMG_PBYTE)psBridgeIn + PVRSRV_MAX_BRIDGE_IN_SIZE);
+
+            
 #if defined(DEBUG)
-        PVR_ASSERT(psBridgePackageKM->ui32InBufferSize < PVRSRV_MAX_BRIDGE_IN_SIZE);
-        PVR_ASSERT(psBridgePackageKM->ui32OutBufferSize < PVRSRV_MAX_BRIDGE_OUT_SIZE);
+            PVR_ASSERT(psBridgePackageKM->ui32InBufferSize < PVRSRV_MAX_BRIDGE_IN_SIZE);
+            PVR_ASSERT(psBridgePackageKM->ui32OutBufferSize < PVRSRV_MAX_BRIDGE_OUT_SIZE);
 #endif
+        }
 
         if(psBridgePackageKM->ui32InBufferSize > 0)
         {
@@ -158,12 +158,16 @@ typedef IMG_INT (*BridgeWrapperFunction)(IMG_UINT32 ui32BridgeID,
 typedef struct _PVRSRV_BRIDGE_DISPATCH_TABLE_ENTRY
 {
 	BridgeWrapperFunction pfFunction; 
+	IMG_BOOL bUnlocked; 
 #if defined(DEBUG_BRIDGE_KM)
 	const IMG_CHAR *pszIOCName; 
 	const IMG_CHAR *pszFunctionName; 
 	IMG_UINT32 ui32CallCount; 
 	IMG_UINT32 ui32CopyFromUserTotalBytes; 
 	IMG_UINT32 ui32CopyToUserTotalBytes; 
+	IMG_UINT64 ui64TotalTimeUs; 
+	IMG_UINT64 ui64LockWaitUs; 
+	IMG_UINT32 ui32MaxTimeUs; 
 #endif
 }PVRSRV_BRIDGE_DISPATCH_TABLE_ENTRY;
 
@@ -198,6 +202,15 @@ _SetDispatchTableEntry(IMG_UINT32 ui32Index,
 #define SetDispatchTableEntry(ui32Index, pfFunction) \
 	_SetDispatchTableEntry(PVRSRV_GET_BRIDGE_ID(ui32Index), #ui32Index, (BridgeWrapperFunction)pfFunction, #pfFunction)
 
+/*
+ * Marks a call that only looks up handles in the caller's own handle base
+ * and reads state; it is dispatched without gPVRSRVLock.
+ */
+#define SetDispatchTableEntryUnlocked(ui32Index) \
+	(g_BridgeDispatchTable[PVRSRV_GET_BRIDGE_ID(ui32Index)].bUnlocked = IMG_TRUE)
+
+IMG_BOOL BridgedCallIsUnlocked(IMG_UINT32 ui32BridgeID);
+
 #define DISPATCH_TABLE_GAP_THRESHOLD 5
 
 #if defined(DEBUG)
@@ -37,6 +37,13 @@
 #define PVRSRV_MAX_BRIDGE_IN_SIZE	0x1000
 #define PVRSRV_MAX_BRIDGE_OUT_SIZE	0x1000
 
+/*
+ * Calls dispatched without gPVRSRVLock cannot use the shared bridge
+ * buffer; their parameters are copied through the caller's stack.
+ */
+#define PVRSRV_MAX_UNLOCKED_BRIDGE_IN_SIZE	0x40
+#define PVRSRV_MAX_UNLOCKED_BRIDGE_OUT_SIZE	0x40
+
 typedef	struct _PVR_PCI_DEV_TAG
 {
 	struct pci_dev		*psPCIDev;
@@ -60,6 +60,7 @@
 #include "mutex.h"
 #include "lock.h"
 #include "event.h"
+#include "env_perproc.h"
 
 typedef struct PVRSRV_LINUX_EVENT_OBJECT_LIST_TAG
 {
@@ -80,6 +81,7 @@ typedef struct PVRSRV_LINUX_EVENT_OBJECT_TAG
 	struct list_head        sList;
 	IMG_HANDLE		hResItem;
 	PVRSRV_LINUX_EVENT_OBJECT_LIST *psLinuxEventObjectList;
+	struct rw_semaphore	*psBridgeLock;
 } PVRSRV_LINUX_EVENT_OBJECT;
 
 PVRSRV_ERROR LinuxEventObjectListCreate(IMG_HANDLE *phEventObjectList)
@@ -210,6 +212,10 @@ PVRSRV_ERROR LinuxEventObjectAdd(IMG_HANDLE hOSEventObjectList, IMG_HANDLE *phOS
 
 	psLinuxEventObject->psLinuxEventObjectList = psLinuxEventObjectList;
 
+	/* Only the opening process can look the object up to wait on it. */
+	psLinuxEventObject->psBridgeLock =
+		&((PVRSRV_ENV_PER_PROCESS_DATA *)PVRSRVProcessPrivateData(psPerProc))->sBridgeLock;
+
 	psLinuxEventObject->hResItem = ResManRegisterRes(psPerProc->hResManContext,
 													 RESMAN_TYPE_EVENT_OBJECT,
 													 psLinuxEventObject,
@@ -268,11 +274,15 @@ PVRSRV_ERROR LinuxEventObjectWait(IMG_HANDLE hOSEventObject, IMG_UINT32 ui32MSTi
 			break;
 		}
 
-		LinuxUnLockMutex(&gPVRSRVLock);		
+		/*
+		 * The wait is dispatched without gPVRSRVLock; let the rest of
+		 * the process make bridge calls while it sleeps.
+		 */
+		up_read(psLinuxEventObject->psBridgeLock);
 
 		ui32TimeOutJiffies = (IMG_UINT32)schedule_timeout((IMG_INT32)ui32TimeOutJiffies);
 		
-		LinuxLockMutex(&gPVRSRVLock);
+		down_read(psLinuxEventObject->psBridgeLock);
 #if defined(DEBUG)
 		psLinuxEventObject->ui32Stats++;
 #endif			
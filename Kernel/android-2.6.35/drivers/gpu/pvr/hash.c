@@ -39,6 +39,17 @@
 #define	KEY_COMPARE(pHash, pKey1, pKey2) \
 	((pHash)->pfnKeyComp((pHash)->uKeySize, (pKey1), (pKey2)))
 
+/*
+ * Resizing does not rehash the whole table at once: the old table is kept
+ * and this many of its chains are moved across on every insert and remove.
+ *
+ * The table doubles when it is more than half full and halves when it is
+ * less than an eighth full. After a resize away from N chains it takes
+ * about N/16 inserts or removes before the next resize is due, which moves
+ * all but the last few old chains; _Resize moves those itself.
+ */
+#define HASH_MIGRATE_CHAINS 16
+
 struct _BUCKET_
 {
 	
@@ -61,6 +72,15 @@ struct _HASH_TABLE_
 	IMG_UINT32 uSize;
 
 	
+	BUCKET **ppOldBucketTable;
+
+	
+	IMG_UINT32 uOldSize;
+
+	
+	IMG_UINT32 uMigrateIndex;
+
+	
 	IMG_UINT32 uCount;
 
 	
@@ -148,30 +168,32 @@ _ChainInsert (HASH_TABLE *pHash, BUCKET *pBucket, BUCKET **ppBucketTable, IMG_UI
 	return PVRSRV_OK;
 }
 
-static PVRSRV_ERROR
-_Rehash (HASH_TABLE *pHash,
-	 BUCKET **ppOldTable, IMG_UINT32 uOldSize,
-         BUCKET **ppNewTable, IMG_UINT32 uNewSize)
+static IMG_VOID
+_MigrateChains (HASH_TABLE *pHash, IMG_UINT32 uChains)
 {
-	IMG_UINT32 uIndex;
-	for (uIndex=0; uIndex< uOldSize; uIndex++)
-    {
-		BUCKET *pBucket;
-		pBucket = ppOldTable[uIndex];
+	while (pHash->ppOldBucketTable != IMG_NULL && uChains-- > 0)
+	{
+		BUCKET *pBucket = pHash->ppOldBucketTable[pHash->uMigrateIndex];
+
 		while (pBucket != IMG_NULL)
 		{
-			PVRSRV_ERROR eError;
 			BUCKET *pNextBucket = pBucket->pNext;
-			eError = _ChainInsert (pHash, pBucket, ppNewTable, uNewSize);
-			if (eError != PVRSRV_OK)
+			if (_ChainInsert (pHash, pBucket, pHash->ppBucketTable, pHash->uSize) != PVRSRV_OK)
 			{
-				PVR_DPF((PVR_DBG_ERROR, "_Rehash: call to _ChainInsert failed"));
-				return eError;
+				PVR_DPF((PVR_DBG_ERROR, "_MigrateChains: call to _ChainInsert failed"));
 			}
 			pBucket = pNextBucket;
 		}
-    }
-	return PVRSRV_OK;
+		pHash->ppOldBucketTable[pHash->uMigrateIndex] = IMG_NULL;
+
+		if (++pHash->uMigrateIndex == pHash->uOldSize)
+		{
+			OSFreeMem (PVRSRV_PAGEABLE_SELECT, sizeof(BUCKET *)*pHash->uOldSize, pHash->ppOldBucketTable, IMG_NULL);
+			pHash->ppOldBucketTable = IMG_NULL;
+			pHash->uOldSize = 0;
+			pHash->uMigrateIndex = 0;
+		}
+	}
 }
 
 static IMG_BOOL
@@ -186,6 +208,9 @@ _Resize (HASH_TABLE *pHash, IMG_UINT32 uNewSize)
                   "HASH_Resize: oldsize=0x%x  newsize=0x%x  count=0x%x",
 				pHash->uSize, uNewSize, pHash->uCount));
 
+		
+		_MigrateChains (pHash, pHash->uOldSize);
+
 		OSAllocMem(PVRSRV_PAGEABLE_SELECT,
                       sizeof (BUCKET *) * uNewSize,
                       (IMG_PVOID*)&ppNewTable, IMG_NULL,
@@ -196,19 +221,50 @@ _Resize (HASH_TABLE *pHash, IMG_UINT32 uNewSize)
         for (uIndex=0; uIndex<uNewSize; uIndex++)
             ppNewTable[uIndex] = IMG_NULL;
 
-        if (_Rehash (pHash, pHash->ppBucketTable, pHash->uSize, ppNewTable, uNewSize) != PVRSRV_OK)
-		{
-			return IMG_FALSE;
-		}
-
-        OSFreeMem (PVRSRV_PAGEABLE_SELECT, sizeof(BUCKET *)*pHash->uSize, pHash->ppBucketTable, IMG_NULL);
         
+        pHash->ppOldBucketTable = pHash->ppBucketTable;
+        pHash->uOldSize = pHash->uSize;
+        pHash->uMigrateIndex = 0;
+
         pHash->ppBucketTable = ppNewTable;
         pHash->uSize = uNewSize;
     }
     return IMG_TRUE;
 }
 
+static BUCKET **
+_FindBucket (HASH_TABLE *pHash, IMG_VOID *pKey)
+{
+	BUCKET **ppBucket;
+	IMG_UINT32 uIndex;
+
+	uIndex = KEY_TO_INDEX(pHash, pKey, pHash->uSize);
+
+	for (ppBucket = &(pHash->ppBucketTable[uIndex]); *ppBucket != IMG_NULL; ppBucket = &((*ppBucket)->pNext))
+	{
+		if (KEY_COMPARE(pHash, (*ppBucket)->k, pKey))
+		{
+			return ppBucket;
+		}
+	}
+
+	
+	if (pHash->ppOldBucketTable != IMG_NULL)
+	{
+		uIndex = KEY_TO_INDEX(pHash, pKey, pHash->uOldSize);
+
+		for (ppBucket = &(pHash->ppOldBucketTable[uIndex]); *ppBucket != IMG_NULL; ppBucket = &((*ppBucket)->pNext))
+		{
+			if (KEY_COMPARE(pHash, (*ppBucket)->k, pKey))
+			{
+				return ppBucket;
+			}
+		}
+	}
+
+	return IMG_NULL;
+}
+
 
 HASH_TABLE * HASH_Create_Extended (IMG_UINT32 uInitialLen, IMG_SIZE_T uKeySize, HASH_FUNC *pfnHashFunc, HASH_KEY_COMP *pfnKeyComp)
 {
@@ -227,6 +283,9 @@ HASH_TABLE * HASH_Create_Extended (IMG_UINT32 uInitialLen, IMG_SIZE_T uKeySize,
 
 	pHash->uCount = 0;
 	pHash->uSize = uInitialLen;
+	pHash->ppOldBucketTable = IMG_NULL;
+	pHash->uOldSize = 0;
+	pHash->uMigrateIndex = 0;
 	pHash->uMinimumSize = uInitialLen;
 	pHash->uKeySize = (IMG_UINT32)uKeySize;
 	pHash->pfnHashFunc = pfnHashFunc;
@@ -268,6 +327,11 @@ HASH_Delete (HASH_TABLE *pHash)
 			PVR_DPF ((PVR_DBG_ERROR, "HASH_Delete: leak detected in hash table!"));
 			PVR_DPF ((PVR_DBG_ERROR, "Likely Cause: client drivers not freeing alocations before destroying devmemcontext"));
 		}
+		if (pHash->ppOldBucketTable != IMG_NULL)
+		{
+			OSFreeMem(PVRSRV_PAGEABLE_SELECT, sizeof(BUCKET *)*pHash->uOldSize, pHash->ppOldBucketTable, IMG_NULL);
+			pHash->ppOldBucketTable = IMG_NULL;
+		}
 		OSFreeMem(PVRSRV_PAGEABLE_SELECT, sizeof(BUCKET *)*pHash->uSize, pHash->ppBucketTable, IMG_NULL);
 		pHash->ppBucketTable = IMG_NULL;
 		OSFreeMem(PVRSRV_PAGEABLE_SELECT, sizeof(HASH_TABLE), pHash, IMG_NULL);
@@ -313,6 +377,8 @@ HASH_Insert_Extended (HASH_TABLE *pHash, IMG_VOID *pKey, IMG_UINTPTR_T v)
 
 	pHash->uCount++;
 
+	_MigrateChains (pHash, HASH_MIGRATE_CHAINS);
+
 	
 	if (pHash->uCount << 1 > pHash->uSize)
     {
@@ -339,7 +405,6 @@ IMG_UINTPTR_T
 HASH_Remove_Extended(HASH_TABLE *pHash, IMG_VOID *pKey)
 {
 	BUCKET **ppBucket;
-	IMG_UINT32 uIndex;
 
 	PVR_DPF ((PVR_DBG_MESSAGE, "HASH_Remove_Extended: Hash=0x%x, pKey=0x%x",
 			(IMG_UINTPTR_T)pHash, (IMG_UINTPTR_T)pKey));
@@ -352,38 +417,35 @@ HASH_Remove_Extended(HASH_TABLE *pHash, IMG_VOID *pKey)
 		return 0;
 	}
 
-	uIndex = KEY_TO_INDEX(pHash, pKey, pHash->uSize);
-
-	for (ppBucket = &(pHash->ppBucketTable[uIndex]); *ppBucket != IMG_NULL; ppBucket = &((*ppBucket)->pNext))
+	ppBucket = _FindBucket (pHash, pKey);
+	if (ppBucket != IMG_NULL)
 	{
-		 
-		if (KEY_COMPARE(pHash, (*ppBucket)->k, pKey))
-		{
-			BUCKET *pBucket = *ppBucket;
-			IMG_UINTPTR_T v = pBucket->v;
-			(*ppBucket) = pBucket->pNext;
+		BUCKET *pBucket = *ppBucket;
+		IMG_UINTPTR_T v = pBucket->v;
+		(*ppBucket) = pBucket->pNext;
 
-			OSFreeMem(PVRSRV_PAGEABLE_SELECT, sizeof(BUCKET) + pHash->uKeySize, pBucket, IMG_NULL);
-			
+		OSFreeMem(PVRSRV_PAGEABLE_SELECT, sizeof(BUCKET) + pHash->uKeySize, pBucket, IMG_NULL);
+		
+
+		pHash->uCount--;
 
-			pHash->uCount--;
+		_MigrateChains (pHash, HASH_MIGRATE_CHAINS);
 
+		
+		if (pHash->uSize > (pHash->uCount << 3) &&
+			pHash->uSize > pHash->uMinimumSize)
+		{
 			
-			if (pHash->uSize > (pHash->uCount << 2) &&
-                pHash->uSize > pHash->uMinimumSize)
-            {
-                
-
-				_Resize (pHash,
-                         PRIVATE_MAX (pHash->uSize >> 1,
-                                      pHash->uMinimumSize));
-            }
-
-			PVR_DPF ((PVR_DBG_MESSAGE,
-                      "HASH_Remove_Extended: Hash=0x%x, pKey=0x%x = 0x%x",
-                      (IMG_UINTPTR_T)pHash, (IMG_UINTPTR_T)pKey, v));
-			return v;
+
+			_Resize (pHash,
+					 PRIVATE_MAX (pHash->uSize >> 1,
+								  pHash->uMinimumSize));
 		}
+
+		PVR_DPF ((PVR_DBG_MESSAGE,
+				  "HASH_Remove_Extended: Hash=0x%x, pKey=0x%x = 0x%x",
+				  (IMG_UINTPTR_T)pHash, (IMG_UINTPTR_T)pKey, v));
+		return v;
 	}
 	PVR_DPF ((PVR_DBG_MESSAGE,
               "HASH_Remove_Extended: Hash=0x%x, pKey=0x%x = 0x0 !!!!",
@@ -404,7 +466,6 @@ IMG_UINTPTR_T
 HASH_Retrieve_Extended (HASH_TABLE *pHash, IMG_VOID *pKey)
 {
 	BUCKET **ppBucket;
-	IMG_UINT32 uIndex;
 
 	PVR_DPF ((PVR_DBG_MESSAGE, "HASH_Retrieve_Extended: Hash=0x%x, pKey=0x%x",
 			(IMG_UINTPTR_T)pHash, (IMG_UINTPTR_T)pKey));
@@ -417,21 +478,16 @@ HASH_Retrieve_Extended (HASH_TABLE *pHash, IMG_VOID *pKey)
 		return 0;
 	}
 
-	uIndex = KEY_TO_INDEX(pHash, pKey, pHash->uSize);
-
-	for (ppBucket = &(pHash->ppBucketTable[uIndex]); *ppBucket != IMG_NULL; ppBucket = &((*ppBucket)->pNext))
+	ppBucket = _FindBucket (pHash, pKey);
+	if (ppBucket != IMG_NULL)
 	{
-		 
-		if (KEY_COMPARE(pHash, (*ppBucket)->k, pKey))
-		{
-			BUCKET *pBucket = *ppBucket;
-			IMG_UINTPTR_T v = pBucket->v;
+		BUCKET *pBucket = *ppBucket;
+		IMG_UINTPTR_T v = pBucket->v;
 
-			PVR_DPF ((PVR_DBG_MESSAGE,
-                      "HASH_Retrieve: Hash=0x%x, pKey=0x%x = 0x%x",
-                      (IMG_UINTPTR_T)pHash, (IMG_UINTPTR_T)pKey, v));
-			return v;
-		}
+		PVR_DPF ((PVR_DBG_MESSAGE,
+				  "HASH_Retrieve: Hash=0x%x, pKey=0x%x = 0x%x",
+				  (IMG_UINTPTR_T)pHash, (IMG_UINTPTR_T)pKey, v));
+		return v;
 	}
 	PVR_DPF ((PVR_DBG_MESSAGE,
               "HASH_Retrieve: Hash=0x%x, pKey=0x%x = 0x0 !!!!",
@@ -447,14 +503,14 @@ HASH_Retrieve (HASH_TABLE *pHash, IMG_UINTPTR_T k)
 	return HASH_Retrieve_Extended(pHash, &k);
 }
 
-PVRSRV_ERROR
-HASH_Iterate(HASH_TABLE *pHash, HASH_pfnCallback pfnCallback)
+static PVRSRV_ERROR
+_IterateTable(BUCKET **ppBucketTable, IMG_UINT32 uSize, HASH_pfnCallback pfnCallback)
 {
 	IMG_UINT32 uIndex;
-	for (uIndex=0; uIndex < pHash->uSize; uIndex++)
+	for (uIndex=0; uIndex < uSize; uIndex++)
 	{
 		BUCKET *pBucket;
-		pBucket = pHash->ppBucketTable[uIndex];
+		pBucket = ppBucketTable[uIndex];
 		while (pBucket != IMG_NULL)
 		{
 			PVRSRV_ERROR eError;
@@ -472,6 +528,18 @@ HASH_Iterate(HASH_TABLE *pHash, HASH_pfnCallback pfnCallback)
 	return PVRSRV_OK;
 }
 
+PVRSRV_ERROR
+HASH_Iterate(HASH_TABLE *pHash, HASH_pfnCallback pfnCallback)
+{
+	PVRSRV_ERROR eError;
+
+	eError = _IterateTable(pHash->ppBucketTable, pHash->uSize, pfnCallback);
+	if (eError != PVRSRV_OK || pHash->ppOldBucketTable == IMG_NULL)
+		return eError;
+
+	return _IterateTable(pHash->ppOldBucketTable, pHash->uOldSize, pfnCallback);
+}
+
 #ifdef HASH_TRACE
 IMG_VOID
 HASH_Dump (HASH_TABLE *pHash)
@@ -501,5 +569,10 @@ HASH_Dump (HASH_TABLE *pHash)
 	PVR_TRACE(("hash table: uMinimumSize=%d  size=%d  count=%d",
 			pHash->uMinimumSize, pHash->uSize, pHash->uCount));
 	PVR_TRACE(("  empty=%d  max=%d", uEmptyCount, uMaxLength));
+	if (pHash->ppOldBucketTable != IMG_NULL)
+	{
+		PVR_TRACE(("  resizing from %d, %d chains left",
+				pHash->uOldSize, pHash->uOldSize - pHash->uMigrateIndex));
+	}
 }
 #endif
@@ -57,6 +57,7 @@ PVRSRV_ERROR OSPerProcessPrivateDataInit(IMG_HANDLE *phOsPrivateData)
 
 	psEnvPerProc->hBlockAlloc = hBlockAlloc;
 
+	init_rwsem(&psEnvPerProc->sBridgeLock);
 
 	LinuxMMapPerProcessConnect(psEnvPerProc);
 
@@ -35,13 +35,16 @@
 #include "private_data.h"
 #include "linkage.h"
 #include "pvr_bridge_km.h"
+#include "env_perproc.h"
+
+#if defined(DEBUG_BRIDGE_KM)
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#endif
 
 #if defined(SUPPORT_DRI_DRM)
 #include <drm/drmP.h>
 #include "pvr_drm.h"
-#if defined(PVR_SECURE_DRM_AUTH_EXPORT)
-#include "env_perproc.h"
-#endif
 #endif
 
 #if defined(SUPPORT_VGX)
@@ -68,6 +71,9 @@ static void ProcSeqShowBridgeStats(struct seq_file *sfile,void* el);
 static void* ProcSeqOff2ElementBridgeStats(struct seq_file * sfile, loff_t off);
 static void ProcSeqStartstopBridgeStats(struct seq_file *sfile,IMG_BOOL start);
 
+/* Calls made without gPVRSRVLock update their timings concurrently. */
+static DEFINE_SPINLOCK(g_sBridgeTimeLock);
+
 #endif
 
 extern PVRSRV_LINUX_MUTEX gPVRSRVLock;
@@ -146,6 +152,8 @@ static void* ProcSeqNextBridgeStats(struct seq_file *sfile,void* el,loff_t off)
 static void ProcSeqShowBridgeStats(struct seq_file *sfile,void* el)
 {
 	PVRSRV_BRIDGE_DISPATCH_TABLE_ENTRY *psEntry = (	PVRSRV_BRIDGE_DISPATCH_TABLE_ENTRY*)el;
+	IMG_UINT64 ui64TotalTimeUs, ui64LockWaitUs;
+	IMG_UINT32 ui32MaxTimeUs;
 
 	if(el == PVR_PROC_SEQ_START_TOKEN) 
 	{
@@ -154,7 +162,7 @@ static void ProcSeqShowBridgeStats(struct seq_file *sfile,void* el)
 						  "Total number of bytes copied via copy_from_user = %u\n"
 						  "Total number of bytes copied via copy_to_user = %u\n"
 						  "Total number of bytes copied via copy_*_user = %u\n\n"
-						  "%-45s | %-40s | %10s | %20s | %10s\n",
+						  "%-45s | %-40s | %10s | %20s | %10s | %14s | %10s | %14s\n",
 						  g_BridgeGlobalStats.ui32IOCTLCount,
 						  g_BridgeGlobalStats.ui32TotalCopyFromUserBytes,
 						  g_BridgeGlobalStats.ui32TotalCopyToUserBytes,
@@ -163,18 +171,58 @@ static void ProcSeqShowBridgeStats(struct seq_file *sfile,void* el)
 						  "Wrapper Function",
 						  "Call Count",
 						  "copy_from_user Bytes",
-						  "copy_to_user Bytes"
+						  "copy_to_user Bytes",
+						  "Total us",
+						  "Max us",
+						  "Lock Wait us"
 						 );
 		return;
 	}
 
+	spin_lock(&g_sBridgeTimeLock);
+	ui64TotalTimeUs = psEntry->ui64TotalTimeUs;
+	ui64LockWaitUs = psEntry->ui64LockWaitUs;
+	ui32MaxTimeUs = psEntry->ui32MaxTimeUs;
+	spin_unlock(&g_sBridgeTimeLock);
+
 	seq_printf(sfile,
-				   "%-45s   %-40s   %-10u   %-20u   %-10u\n",
+				   "%-45s   %-40s   %-10u   %-20u   %-10u   %-14llu   %-10u   %-14llu\n",
 				   psEntry->pszIOCName,
 				   psEntry->pszFunctionName,
 				   psEntry->ui32CallCount,
 				   psEntry->ui32CopyFromUserTotalBytes,
-				   psEntry->ui32CopyToUserTotalBytes);
+				   psEntry->ui32CopyToUserTotalBytes,
+				   ui64TotalTimeUs,
+				   ui32MaxTimeUs,
+				   ui64LockWaitUs);
+}
+
+/*
+ * Charges one call to its dispatch table entry: the time from entering the
+ * ioctl to leaving it, and the part of that spent waiting for gPVRSRVLock
+ * and the per-process bridge lock.
+ */
+static IMG_VOID BridgeStatsRecordTime(IMG_UINT32 ui32BridgeID, ktime_t sStart, ktime_t sLockWait)
+{
+	PVRSRV_BRIDGE_DISPATCH_TABLE_ENTRY *psEntry;
+	IMG_UINT32 ui32TimeUs;
+
+	if(ui32BridgeID >= BRIDGE_DISPATCH_TABLE_ENTRY_COUNT)
+	{
+		return;
+	}
+
+	psEntry = &g_BridgeDispatchTable[ui32BridgeID];
+	ui32TimeUs = (IMG_UINT32)ktime_to_us(ktime_sub(ktime_get(), sStart));
+
+	spin_lock(&g_sBridgeTimeLock);
+	psEntry->ui64TotalTimeUs += ui32TimeUs;
+	psEntry->ui64LockWaitUs += (IMG_UINT64)ktime_to_us(sLockWait);
+	if(ui32TimeUs > psEntry->ui32MaxTimeUs)
+	{
+		psEntry->ui32MaxTimeUs = ui32TimeUs;
+	}
+	spin_unlock(&g_sBridgeTimeLock);
 }
 
 #endif 
@@ -196,10 +244,22 @@ PVRSRV_BridgeDispatchKM(struct file *pFile, unsigned int unref__ ioctlCmd, unsig
 	PVRSRV_BRIDGE_PACKAGE *psBridgePackageKM;
 	IMG_UINT32 ui32PID = OSGetCurrentProcessIDKM();
 	PVRSRV_PER_PROCESS_DATA *psPerProc;
+	PVRSRV_ENV_PER_PROCESS_DATA *psEnvPerProc;
+	IMG_BOOL bUnlocked;
 	IMG_INT err = -EFAULT;
+#if defined(DEBUG_BRIDGE_KM)
+	ktime_t sStart, sLockStart, sLockWait;
+	IMG_BOOL bTimed = IMG_FALSE;
+
+	sStart = ktime_get();
+#endif
 
 	LinuxLockMutex(&gPVRSRVLock);
 
+#if defined(DEBUG_BRIDGE_KM)
+	sLockWait = ktime_sub(ktime_get(), sStart);
+#endif
+
 #if defined(SUPPORT_DRI_DRM)
 	psBridgePackageKM = (PVRSRV_BRIDGE_PACKAGE *)arg;
 	PVR_ASSERT(psBridgePackageKM != IMG_NULL);
@@ -322,7 +382,6 @@ PVRSRV_BridgeDispatchKM(struct file *pFile, unsigned int unref__ ioctlCmd, unsig
 		{
 			PVRSRV_FILE_PRIVATE_DATA *psPrivateData;
 			int authenticated = pFile->authenticated;
-			PVRSRV_ENV_PER_PROCESS_DATA *psEnvPerProc;
 
 			if (authenticated)
 			{
@@ -365,7 +424,47 @@ PVRSRV_BridgeDispatchKM(struct file *pFile, unsigned int unref__ ioctlCmd, unsig
 	}
 #endif 
 
+	psEnvPerProc = (PVRSRV_ENV_PER_PROCESS_DATA *)PVRSRVProcessPrivateData(psPerProc);
+	if(psEnvPerProc == IMG_NULL)
+	{
+		PVR_DPF((PVR_DBG_ERROR, "%s: Process private data not allocated", __FUNCTION__));
+		goto unlock_and_return;
+	}
+
+	/*
+	 * Calls marked unlocked only touch the caller's own handle base, so
+	 * they need to exclude other threads of the same process and nothing
+	 * else. psPerProc stays valid without gPVRSRVLock because the file
+	 * reference held by this ioctl keeps the process connected.
+	 */
+	bUnlocked = BridgedCallIsUnlocked(psBridgePackageKM->ui32BridgeID);
+
+#if defined(DEBUG_BRIDGE_KM)
+	sLockStart = ktime_get();
+#endif
+	if(bUnlocked)
+	{
+		down_read(&psEnvPerProc->sBridgeLock);
+		LinuxUnLockMutex(&gPVRSRVLock);
+	}
+	else
+	{
+		down_write(&psEnvPerProc->sBridgeLock);
+	}
+#if defined(DEBUG_BRIDGE_KM)
+	sLockWait = ktime_add(sLockWait, ktime_sub(ktime_get(), sLockStart));
+	bTimed = IMG_TRUE;
+#endif
+
 	err = BridgedDispatchKM(psPerProc, psBridgePackageKM);
+
+	if(bUnlocked)
+	{
+		up_read(&psEnvPerProc->sBridgeLock);
+		goto return_unlocked;
+	}
+	up_write(&psEnvPerProc->sBridgeLock);
+
 	if(err != PVRSRV_OK)
 		goto unlock_and_return;
 
@@ -409,5 +508,13 @@ PVRSRV_BridgeDispatchKM(struct file *pFile, unsigned int unref__ ioctlCmd, unsig
 
 unlock_and_return:
 	LinuxUnLockMutex(&gPVRSRVLock);
+
+return_unlocked:
+#if defined(DEBUG_BRIDGE_KM)
+	if(bTimed)
+	{
+		BridgeStatsRecordTime(psBridgePackageKM->ui32BridgeID, sStart, sLockWait);
+	}
+#endif
 	return err;
 }
@@ -128,7 +128,16 @@ struct _RA_ARENA_
 #define FREE_TABLE_LIMIT 32
 
 	
-	BT *aHeadFree [FREE_TABLE_LIMIT];
+#define FREE_CLASS_SHIFT 2
+#define FREE_CLASS_SUBDIVS (1 << FREE_CLASS_SHIFT)
+#define FREE_CLASS_COUNT (FREE_TABLE_LIMIT << FREE_CLASS_SHIFT)
+#define FREE_BITMAP_WORDS (FREE_CLASS_COUNT / 32)
+
+	
+	BT *aHeadFree [FREE_CLASS_COUNT];
+
+	
+	IMG_UINT32 auFreeBitmap [FREE_BITMAP_WORDS];
 
 	
 	BT *pHeadSegment;
@@ -216,6 +225,66 @@ pvr_log2 (IMG_SIZE_T n)
 	return l;
 }
 
+/*
+ * Free segments are kept on one list per size class. Each power of two is
+ * split into FREE_CLASS_SUBDIVS classes by the bits below the leading one,
+ * so every segment on a list above the request's own class is big enough.
+ */
+static IMG_UINT32
+_FreeClass (IMG_SIZE_T uSize)
+{
+	IMG_UINT32 uLog2 = pvr_log2 (uSize);
+	IMG_UINT32 uSub;
+
+	if (uLog2 >= FREE_TABLE_LIMIT)
+		return FREE_CLASS_COUNT - 1;
+
+	if (uLog2 < FREE_CLASS_SHIFT)
+		uSub = (IMG_UINT32)(uSize << (FREE_CLASS_SHIFT - uLog2));
+	else
+		uSub = (IMG_UINT32)(uSize >> (uLog2 - FREE_CLASS_SHIFT));
+
+	return (uLog2 << FREE_CLASS_SHIFT) | (uSub & (FREE_CLASS_SUBDIVS - 1));
+}
+
+static IMG_UINT32
+_LowestSetBit (IMG_UINT32 uBits)
+{
+#if defined(__linux__)
+	return (IMG_UINT32)__ffs (uBits);
+#else
+	IMG_UINT32 uBit = 0;
+
+	while ((uBits & 1) == 0)
+	{
+		uBits >>= 1;
+		uBit++;
+	}
+	return uBit;
+#endif
+}
+
+static IMG_UINT32
+_FreeClassFindNext (RA_ARENA *pArena, IMG_UINT32 uClass)
+{
+	IMG_UINT32 uWord;
+	IMG_UINT32 uBits;
+
+	if (uClass >= FREE_CLASS_COUNT)
+		return FREE_CLASS_COUNT;
+
+	uWord = uClass >> 5;
+	uBits = pArena->auFreeBitmap[uWord] & (~0U << (uClass & 31));
+	while (uBits == 0)
+	{
+		if (++uWord == FREE_BITMAP_WORDS)
+			return FREE_CLASS_COUNT;
+		uBits = pArena->auFreeBitmap[uWord];
+	}
+
+	return (uWord << 5) + _LowestSetBit (uBits);
+}
+
 static PVRSRV_ERROR
 _SegmentListInsertAfter (RA_ARENA *pArena,
 						 BT *pInsertionPoint,
@@ -367,12 +436,14 @@ static IMG_VOID
 _FreeListInsert (RA_ARENA *pArena, BT *pBT)
 {
 	IMG_UINT32 uIndex;
-	uIndex = pvr_log2 (pBT->uSize);
+	uIndex = _FreeClass (pBT->uSize);
 	pBT->type = btt_free;
 	pBT->pNextFree = pArena->aHeadFree [uIndex];
 	pBT->pPrevFree = IMG_NULL;
 	if (pArena->aHeadFree[uIndex] != IMG_NULL)
 		pArena->aHeadFree[uIndex]->pPrevFree = pBT;
+	else
+		pArena->auFreeBitmap[uIndex >> 5] |= 1U << (uIndex & 31);
 	pArena->aHeadFree [uIndex] = pBT;
 }
 
@@ -380,13 +451,15 @@ static IMG_VOID
 _FreeListRemove (RA_ARENA *pArena, BT *pBT)
 {
 	IMG_UINT32 uIndex;
-	uIndex = pvr_log2 (pBT->uSize);
+	uIndex = _FreeClass (pBT->uSize);
 	if (pBT->pNextFree != IMG_NULL)
 		pBT->pNextFree->pPrevFree = pBT->pPrevFree;
 	if (pBT->pPrevFree == IMG_NULL)
 		pArena->aHeadFree[uIndex] = pBT->pNextFree;
 	else
 		pBT->pPrevFree->pNextFree = pBT->pNextFree;
+	if (pArena->aHeadFree[uIndex] == IMG_NULL)
+		pArena->auFreeBitmap[uIndex >> 5] &= ~(1U << (uIndex & 31));
 }
 
 static BT *
@@ -702,18 +775,9 @@ _AttemptAllocAligned (RA_ARENA *pArena,
 
 	
 
-	uIndex = pvr_log2 (uSize);
+	uIndex = _FreeClassFindNext (pArena, _FreeClass (uSize));
 
-#if 0
-	
-	if (1u<<uIndex < uSize)
-		uIndex++;
-#endif
-
-	while (uIndex < FREE_TABLE_LIMIT && pArena->aHeadFree[uIndex]==IMG_NULL)
-		uIndex++;
-
-	while (uIndex < FREE_TABLE_LIMIT)
+	while (uIndex < FREE_CLASS_COUNT)
 	{
 		if (pArena->aHeadFree[uIndex]!=IMG_NULL)
 		{
@@ -832,7 +896,7 @@ _AttemptAllocAligned (RA_ARENA *pArena,
 			}
 
 		}
-		uIndex++;
+		uIndex = _FreeClassFindNext (pArena, uIndex + 1);
 	}
 
 	return IMG_FALSE;
@@ -874,8 +938,10 @@ RA_Create (IMG_CHAR *name,
 	pArena->pImportFree = imp_free;
 	pArena->pBackingStoreFree = backingstore_free;
 	pArena->pImportHandle = pImportHandle;
-	for (i=0; i<FREE_TABLE_LIMIT; i++)
+	for (i=0; i<FREE_CLASS_COUNT; i++)
 		pArena->aHeadFree[i] = IMG_NULL;
+	for (i=0; i<FREE_BITMAP_WORDS; i++)
+		pArena->auFreeBitmap[i] = 0;
 	pArena->pHeadSegment = IMG_NULL;
 	pArena->pTailSegment = IMG_NULL;
 	pArena->uQuantum = uQuantum;
@@ -980,8 +1046,10 @@ RA_Delete (RA_ARENA *pArena)
 	PVR_DPF ((PVR_DBG_MESSAGE,
 			  "RA_Delete: name='%s'", pArena->name));
 
-	for (uIndex=0; uIndex<FREE_TABLE_LIMIT; uIndex++)
+	for (uIndex=0; uIndex<FREE_CLASS_COUNT; uIndex++)
 		pArena->aHeadFree[uIndex] = IMG_NULL;
+	for (uIndex=0; uIndex<FREE_BITMAP_WORDS; uIndex++)
+		pArena->auFreeBitmap[uIndex] = 0;
 
 	while (pArena->pHeadSegment != IMG_NULL)
 	{
@@ -1515,6 +1583,31 @@ RA_Dump (RA_ARENA *pArena)
 
 #if defined(CONFIG_PROC_FS) && defined(DEBUG)
 
+#ifdef RA_STATS
+static IMG_SIZE_T
+_LargestFreeSegment (RA_ARENA *pArena)
+{
+	IMG_UINT32 uIndex;
+	IMG_SIZE_T uLargest = 0;
+	BT *pBT;
+
+	
+	for (uIndex = FREE_CLASS_COUNT; uIndex-- > 0; )
+	{
+		if (pArena->aHeadFree[uIndex] != IMG_NULL)
+		{
+			for (pBT = pArena->aHeadFree[uIndex]; pBT != IMG_NULL; pBT = pBT->pNextFree)
+			{
+				if (pBT->uSize > uLargest)
+					uLargest = pBT->uSize;
+			}
+			break;
+		}
+	}
+
+	return uLargest;
+}
+#endif
 
 static void RA_ProcSeqShowInfo(struct seq_file *sfile, void* el)
 {
@@ -1557,6 +1650,21 @@ static void RA_ProcSeqShowInfo(struct seq_file *sfile, void* el)
 	case 10:
 		seq_printf(sfile, "export count\t\t%u\n", pArena->sStatistics.uExportCount);
 		break;
+	case 11:
+	{
+		IMG_SIZE_T uLargest = _LargestFreeSegment (pArena);
+		IMG_SIZE_T uFree = pArena->sStatistics.uFreeResourceCount;
+		IMG_UINT32 uFragmentation = 0;
+
+		
+		if (uFree >= 100 && uLargest / (uFree / 100) < 100)
+		{
+			uFragmentation = 100 - (IMG_UINT32)(uLargest / (uFree / 100));
+		}
+		seq_printf(sfile, "largest free segment\t%u (0x%x), %u%% fragmented\n",
+							(IMG_UINT)uLargest, (IMG_UINT)uLargest, uFragmentation);
+		break;
+	}
 #endif
 	}
 
@@ -1565,7 +1673,7 @@ static void RA_ProcSeqShowInfo(struct seq_file *sfile, void* el)
 static void* RA_ProcSeqOff2ElementInfo(struct seq_file * sfile, loff_t off)
 {
 #ifdef RA_STATS
-	if(off <= 9)
+	if(off <= 10)
 #else
 	if(off <= 1)
 #endif
@@ -23,12 +23,13 @@
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
 #include <linux/sched.h>
+#include <linux/vmalloc.h>
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
 
 #define PMEM_MAX_DEVICES 10
-#define PMEM_MAX_ORDER 128
+#define PMEM_MAX_ORDER (BITS_PER_LONG - 1)
 #define PMEM_MIN_ALLOC PAGE_SIZE
 
 #define PMEM_DEBUG 1
@@ -56,6 +57,8 @@ struct pmem_data {
 	int index;
 	/* see flags above for descriptions */
 	unsigned int flags;
+	/* PMEM_CACHE_POLICY_* used when this file is mmaped */
+	unsigned int cache_policy;
 	/* protects this data field, if the mm_mmap sem will be held at the
 	 * same time as this sem, the mm sem must be taken first (as this is
 	 * the order for vma_open and vma_close ops */
@@ -82,6 +85,7 @@ struct pmem_data {
 struct pmem_bits {
 	unsigned allocated:1;		/* 1 if allocated, 0 if free */
 	unsigned order:7;		/* size of the region in pmem space */
+	struct list_head free;		/* entry in the free list for order */
 };
 
 struct pmem_region_node {
@@ -116,6 +120,12 @@ struct pmem_info {
 	/* the bitmap for the region indicating which entries are allocated
 	 * and which are free */
 	struct pmem_bits *bitmap;
+	/* free blocks of each order, by their first bitmap entry, and the
+	 * number of free and allocated blocks of each order; all protected
+	 * by bitmap_sem like the bitmap itself */
+	struct list_head free_list[PMEM_MAX_ORDER + 1];
+	unsigned long nr_free[PMEM_MAX_ORDER + 1];
+	unsigned long nr_allocated[PMEM_MAX_ORDER + 1];
 	/* indicates the region should not be managed with an allocator */
 	unsigned no_allocator;
 	/* indicates maps of this region should be cached, if a mix of
@@ -156,6 +166,7 @@ static int id_count;
 #define PMEM_ORDER(id, index) pmem[id].bitmap[index].order
 #define PMEM_BUDDY_INDEX(id, index) (index ^ (1 << PMEM_ORDER(id, index)))
 #define PMEM_NEXT_INDEX(id, index) (index + (1 << PMEM_ORDER(id, index)))
+#define PMEM_FREE_INDEX(id, bits) ((int)((bits) - pmem[id].bitmap))
 #define PMEM_OFFSET(index) (index * PMEM_MIN_ALLOC)
 #define PMEM_START_ADDR(id, index) (PMEM_OFFSET(index) + pmem[id].base)
 #define PMEM_LEN(id, index) ((1 << PMEM_ORDER(id, index)) * PMEM_MIN_ALLOC)
@@ -232,6 +243,20 @@ static int is_master_owner(struct file *file)
 	return ret;
 }
 
+static void pmem_free_list_add(int id, int index)
+{
+	int order = PMEM_ORDER(id, index);
+
+	list_add(&pmem[id].bitmap[index].free, &pmem[id].free_list[order]);
+	pmem[id].nr_free[order]++;
+}
+
+static void pmem_free_list_del(int id, int index)
+{
+	list_del(&pmem[id].bitmap[index].free);
+	pmem[id].nr_free[PMEM_ORDER(id, index)]--;
+}
+
 static int pmem_free(int id, int index)
 {
 	/* caller should hold the write lock on pmem_sem! */
@@ -244,21 +269,23 @@ static int pmem_free(int id, int index)
 	}
 	/* clean up the bitmap, merging any buddies */
 	pmem[id].bitmap[curr].allocated = 0;
+	pmem[id].nr_allocated[PMEM_ORDER(id, curr)]--;
 	/* find a slots buddy Buddy# = Slot# ^ (1 << order)
 	 * if the buddy is also free merge them
 	 * repeat until the buddy is not free or end of the bitmap is reached
 	 */
-	do {
+	while (PMEM_ORDER(id, curr) < PMEM_MAX_ORDER) {
 		buddy = PMEM_BUDDY_INDEX(id, curr);
-		if (PMEM_IS_FREE(id, buddy) &&
-				PMEM_ORDER(id, buddy) == PMEM_ORDER(id, curr)) {
-			PMEM_ORDER(id, buddy)++;
-			PMEM_ORDER(id, curr)++;
-			curr = min(buddy, curr);
-		} else {
+		if (buddy >= pmem[id].num_entries ||
+		    !PMEM_IS_FREE(id, buddy) ||
+		    PMEM_ORDER(id, buddy) != PMEM_ORDER(id, curr))
 			break;
-		}
-	} while (curr < pmem[id].num_entries);
+		pmem_free_list_del(id, buddy);
+		PMEM_ORDER(id, buddy)++;
+		PMEM_ORDER(id, curr)++;
+		curr = min(buddy, curr);
+	}
+	pmem_free_list_add(id, curr);
 
 	return 0;
 }
@@ -344,6 +371,7 @@ static int pmem_open(struct inode *inode, struct file *file)
 		return -1;
 	}
 	data->flags = 0;
+	data->cache_policy = PMEM_CACHE_POLICY_DEFAULT;
 	data->index = -1;
 	data->task = NULL;
 	data->vma = NULL;
@@ -380,10 +408,9 @@ static int pmem_allocate(int id, unsigned long len)
 {
 	/* caller should hold the write lock on pmem_sem! */
 	/* return the corresponding pdata[] entry */
-	int curr = 0;
-	int end = pmem[id].num_entries;
-	int best_fit = -1;
-	unsigned long order = pmem_order(len);
+	struct pmem_bits *bits;
+	int best_fit;
+	unsigned long curr, order = pmem_order(len);
 
 	if (pmem[id].no_allocator) {
 		DLOG("no allocator");
@@ -397,50 +424,62 @@ static int pmem_allocate(int id, unsigned long len)
 		return -1;
 	DLOG("order %lx\n", order);
 
-	/* look through the bitmap:
-	 * 	if you find a free slot of the correct order use it
+	/* look through the free lists:
+	 * 	if there is a free slot of the correct order use it
 	 * 	otherwise, use the best fit (smallest with size > order) slot
 	 */
-	while (curr < end) {
-		if (PMEM_IS_FREE(id, curr)) {
-			if (PMEM_ORDER(id, curr) == (unsigned char)order) {
-				/* set the not free bit and clear others */
-				best_fit = curr;
-				break;
-			}
-			if (PMEM_ORDER(id, curr) > (unsigned char)order &&
-			    (best_fit < 0 ||
-			     PMEM_ORDER(id, curr) < PMEM_ORDER(id, best_fit)))
-				best_fit = curr;
-		}
-		curr = PMEM_NEXT_INDEX(id, curr);
-	}
+	for (curr = order; curr <= PMEM_MAX_ORDER; curr++)
+		if (!list_empty(&pmem[id].free_list[curr]))
+			break;
 
-	/* if best_fit < 0, there are no suitable slots,
+	/* if every list is empty, there are no suitable slots,
 	 * return an error
 	 */
-	if (best_fit < 0) {
+	if (curr > PMEM_MAX_ORDER) {
 		printk("pmem: no space left to allocate!\n");
 		return -1;
 	}
 
+	bits = list_first_entry(&pmem[id].free_list[curr], struct pmem_bits,
+				free);
+	best_fit = PMEM_FREE_INDEX(id, bits);
+	pmem_free_list_del(id, best_fit);
+
 	/* now partition the best fit:
 	 * 	split the slot into 2 buddies of order - 1
 	 * 	repeat until the slot is of the correct order
+	 * 	and put each upper half on its free list
 	 */
 	while (PMEM_ORDER(id, best_fit) > (unsigned char)order) {
 		int buddy;
 		PMEM_ORDER(id, best_fit) -= 1;
 		buddy = PMEM_BUDDY_INDEX(id, best_fit);
 		PMEM_ORDER(id, buddy) = PMEM_ORDER(id, best_fit);
+		pmem[id].bitmap[buddy].allocated = 0;
+		pmem_free_list_add(id, buddy);
 	}
 	pmem[id].bitmap[best_fit].allocated = 1;
+	pmem[id].nr_allocated[order]++;
 	return best_fit;
 }
 
 static pgprot_t android_phys_mem_access_prot(struct file *file, pgprot_t vma_prot)
 {
+	struct pmem_data *data = (struct pmem_data *)file->private_data;
 	int id = get_id(file);
+
+	switch (data->cache_policy) {
+	case PMEM_CACHE_POLICY_CACHED:
+		return vma_prot;
+#ifdef pgprot_writecombine
+	case PMEM_CACHE_POLICY_WRITECOMBINE:
+		return pgprot_writecombine(vma_prot);
+#endif
+#ifdef pgprot_noncached
+	case PMEM_CACHE_POLICY_UNCACHED:
+		return pgprot_noncached(vma_prot);
+#endif
+	}
 #ifdef pgprot_noncached
 	if (pmem[id].cached == 0 || file->f_flags & O_SYNC)
 		return pgprot_noncached(vma_prot);
@@ -779,6 +818,19 @@ void put_pmem_file(struct file *file)
 	fput(file);
 }
 
+/* does this file's mapping go through the cpu caches? */
+static int pmem_cached(int id, struct file *file, struct pmem_data *data)
+{
+	switch (data->cache_policy) {
+	case PMEM_CACHE_POLICY_CACHED:
+		return 1;
+	case PMEM_CACHE_POLICY_UNCACHED:
+	case PMEM_CACHE_POLICY_WRITECOMBINE:
+		return 0;
+	}
+	return pmem[id].cached && !(file->f_flags & O_SYNC);
+}
+
 void flush_pmem_file(struct file *file, unsigned long offset, unsigned long len)
 {
 	struct pmem_data *data;
@@ -794,7 +846,7 @@ void flush_pmem_file(struct file *file, unsigned long offset, unsigned long len)
 
 	id = get_id(file);
 	data = (struct pmem_data *)file->private_data;
-	if (!pmem[id].cached || file->f_flags & O_SYNC)
+	if (!pmem_cached(id, file, data))
 		return;
 
 	down_read(&data->sem);
@@ -820,6 +872,102 @@ end:
 	up_read(&data->sem);
 }
 
+static int pmem_set_cache_policy(struct file *file, unsigned long policy)
+{
+	struct pmem_data *data = (struct pmem_data *)file->private_data;
+	int ret = 0;
+
+	if (policy > PMEM_CACHE_POLICY_CACHED)
+		return -EINVAL;
+
+	down_write(&data->sem);
+	/* the policy is applied to the page protections at mmap time */
+	if (data->flags & (PMEM_FLAGS_MASTERMAP | PMEM_FLAGS_SUBMAP |
+			   PMEM_FLAGS_UNSUBMAP))
+		ret = -EBUSY;
+	else
+		data->cache_policy = policy;
+	up_write(&data->sem);
+	return ret;
+}
+
+/*
+ * Cache maintenance on part of an allocation. The kernel mapping of the
+ * region is used for the inner cache and the physical range for the
+ * outer cache, so it works from any process. Uncached and write-combined
+ * mappings only need their write buffers drained.
+ */
+static int pmem_cache_range(struct file *file, struct pmem_cache_range *range)
+{
+	struct pmem_data *data = (struct pmem_data *)file->private_data;
+	struct pmem_region_node *region_node;
+	struct list_head *elt;
+	unsigned long start, end;
+	void *vaddr;
+	int id = get_id(file), ret = 0;
+
+	if (range->op < PMEM_CACHE_CLEAN ||
+	    range->op > PMEM_CACHE_CLEAN_INVALIDATE)
+		return -EINVAL;
+	if (!has_allocation(file))
+		return -EINVAL;
+	if (!range->len)
+		return 0;
+
+	down_read(&data->sem);
+	if (range->offset + range->len < range->offset ||
+	    range->offset + range->len > pmem_len(id, data)) {
+		ret = -EINVAL;
+		goto end;
+	}
+
+	/* a connected file may only touch the regions it has been given,
+	 * invalidating anything else could throw away the master's data */
+	if (data->flags & PMEM_FLAGS_CONNECTED) {
+		ret = -EINVAL;
+		list_for_each(elt, &data->region_list) {
+			region_node = list_entry(elt, struct pmem_region_node,
+						 list);
+			if (range->offset >= region_node->region.offset &&
+			    range->offset + range->len <=
+			    region_node->region.offset +
+			    region_node->region.len) {
+				ret = 0;
+				break;
+			}
+		}
+		if (ret)
+			goto end;
+	}
+
+	if (!pmem_cached(id, file, data)) {
+		mb();
+		goto end;
+	}
+
+	vaddr = pmem_start_vaddr(id, data) + range->offset;
+	start = pmem_start_addr(id, data) + range->offset;
+	end = start + range->len;
+
+	switch (range->op) {
+	case PMEM_CACHE_CLEAN:
+		dmac_clean_range(vaddr, vaddr + range->len);
+		outer_clean_range(start, end);
+		break;
+	case PMEM_CACHE_INVALIDATE:
+		outer_inv_range(start, end);
+		dmac_inv_range(vaddr, vaddr + range->len);
+		break;
+	case PMEM_CACHE_CLEAN_INVALIDATE:
+		dmac_flush_range(vaddr, vaddr + range->len);
+		outer_flush_range(start, end);
+		break;
+	}
+end:
+	up_read(&data->sem);
+	return ret;
+}
+
 static int pmem_connect(unsigned long connect, struct file *file)
 {
 	struct pmem_data *data = (struct pmem_data *)file->private_data;
@@ -1139,7 +1287,9 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			if (has_allocation(file))
 				return -EINVAL;
 			data = (struct pmem_data *)file->private_data;
+			down_write(&pmem[id].bitmap_sem);
 			data->index = pmem_allocate(id, arg);
+			up_write(&pmem[id].bitmap_sem);
 			break;
 		}
 	case PMEM_CONNECT:
@@ -1156,6 +1306,18 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			flush_pmem_file(file, region.offset, region.len);
 			break;
 		}
+	case PMEM_SET_CACHE_POLICY:
+		DLOG("set cache policy %lu\n", arg);
+		return pmem_set_cache_policy(file, arg);
+	case PMEM_CACHE_RANGE:
+		{
+			struct pmem_cache_range range;
+			DLOG("cache range\n");
+			if (copy_from_user(&range, (void __user *)arg,
+					   sizeof(struct pmem_cache_range)))
+				return -EFAULT;
+			return pmem_cache_range(file, &range);
+		}
 	default:
 		if (pmem[id].ioctl)
 			return pmem[id].ioctl(file, cmd, arg);
@@ -1171,6 +1333,46 @@ static ssize_t debug_open(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/*
+ * Per-order block counts and a fragmentation summary: the share of free
+ * memory that lies outside the largest free block, in percent. A region
+ * whose free space is one block reports 0.
+ */
+static int debug_read_orders(int id, char *buffer, int bufmax)
+{
+	unsigned long free_pages = 0, largest = 0;
+	int order, n = 0;
+
+	if (pmem[id].no_allocator)
+		return scnprintf(buffer, bufmax, "no allocator: %s\n",
+				 pmem[id].allocated ? "allocated" : "free");
+
+	n += scnprintf(buffer + n, bufmax - n,
+		       "order: size free allocated\n");
+
+	down_read(&pmem[id].bitmap_sem);
+	for (order = 0; order <= PMEM_MAX_ORDER; order++) {
+		if (!pmem[id].nr_free[order] && !pmem[id].nr_allocated[order])
+			continue;
+		n += scnprintf(buffer + n, bufmax - n, "%5d: %luK %lu %lu\n",
+			       order, (PMEM_MIN_ALLOC << order) >> 10,
+			       pmem[id].nr_free[order],
+			       pmem[id].nr_allocated[order]);
+		free_pages += pmem[id].nr_free[order] << order;
+		if (pmem[id].nr_free[order])
+			largest = 1UL << order;
+	}
+	up_read(&pmem[id].bitmap_sem);
+
+	n += scnprintf(buffer + n, bufmax - n,
+		       "free %luK of %luK, largest free block %luK, "
+		       "fragmentation %lu%%\n",
+		       (free_pages * PMEM_MIN_ALLOC) >> 10, pmem[id].size >> 10,
+		       (largest * PMEM_MIN_ALLOC) >> 10,
+		       free_pages ? 100 - largest * 100 / free_pages : 0);
+	return n;
+}
+
 static ssize_t debug_read(struct file *file, char __user *buf, size_t count,
 			  loff_t *ppos)
 {
@@ -1183,7 +1385,8 @@ static ssize_t debug_read(struct file *file, char __user *buf, size_t count,
 	int n = 0;
 
 	DLOG("debug open\n");
-	n = scnprintf(buffer, debug_bufmax,
+	n = debug_read_orders(id, buffer, debug_bufmax);
+	n += scnprintf(buffer + n, debug_bufmax - n,
 		      "pid #: mapped regions (offset, len) (offset,len)...\n");
 
 	down(&pmem[id].data_list_sem);
@@ -1254,17 +1457,22 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	}
 	pmem[id].num_entries = pmem[id].size / PMEM_MIN_ALLOC;
 
-	pmem[id].bitmap = kmalloc(pmem[id].num_entries *
-				  sizeof(struct pmem_bits), GFP_KERNEL);
+	/* 12 bytes per page with the free list nodes, so not contiguous */
+	pmem[id].bitmap = vmalloc(pmem[id].num_entries *
+				  sizeof(struct pmem_bits));
 	if (!pmem[id].bitmap)
 		goto err_no_mem_for_metadata;
 
 	memset(pmem[id].bitmap, 0, sizeof(struct pmem_bits) *
 					  pmem[id].num_entries);
 
+	for (i = 0; i <= PMEM_MAX_ORDER; i++)
+		INIT_LIST_HEAD(&pmem[id].free_list[i]);
+
 	for (i = sizeof(pmem[id].num_entries) * 8 - 1; i >= 0; i--) {
 		if ((pmem[id].num_entries) &  1<<i) {
 			PMEM_ORDER(id, index) = i;
+			pmem_free_list_add(id, index);
 			index = PMEM_NEXT_INDEX(id, index);
 		}
 	}
@@ -1293,7 +1501,7 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 #endif
 	return 0;
 error_cant_remap:
-	kfree(pmem[id].bitmap);
+	vfree(pmem[id].bitmap);
 err_no_mem_for_metadata:
 	misc_deregister(&pmem[id].dev);
 err_cant_register_device:
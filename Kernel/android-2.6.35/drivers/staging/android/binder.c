@@ -19,6 +19,7 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -36,13 +37,32 @@
 
 #include "binder.h"
 
+/*
+ * Lock ordering:
+ *	binder_lock -> binder_procs_lock -> proc->threads_lock
+ *	binder_lock -> binder_procs_lock -> proc->alloc_lock -> mmap_sem
+ *
+ * binder_lock serializes the node and ref trees, the todo lists and the
+ * transaction stacks.  proc->alloc_lock covers the buffer allocator and
+ * page pool of one proc, so binder_transaction() drops binder_lock while
+ * it allocates the target buffer and copies the payload into it; the
+ * target proc and node are pinned with their tmp_refs meanwhile.
+ * binder_procs_lock only covers the binder_procs list and
+ * proc->threads_lock only covers proc->threads, so that opening the device
+ * and polling it do not wait behind IPC in other processes.  binder_lock is never taken with
+ * proc->alloc_lock held, and the shrinker only trylocks proc->alloc_lock.
+ */
 static DEFINE_MUTEX(binder_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DEFINE_MUTEX(binder_procs_lock);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
 
+/* pages parked in the per-proc pools */
+static atomic_t binder_pages_cached = ATOMIC_INIT(0);
+
 static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
@@ -148,20 +168,20 @@ enum binder_stat_types {
 struct binder_stats {
 	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
 	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
 struct binder_transaction_log_entry {
@@ -210,6 +230,38 @@ struct binder_work {
 	} type;
 };
 
+/*
+ * Latency distribution in microseconds.  Bucket 0 counts samples below 1us,
+ * bucket i counts samples in [2^(i-1), 2^i) us and the last bucket takes
+ * everything above.
+ */
+#define BINDER_LATENCY_BUCKETS 16
+
+struct binder_latency_hist {
+	unsigned int count;
+	unsigned int max_us;
+	u64 total_us;
+	unsigned int bucket[BINDER_LATENCY_BUCKETS];
+};
+
+static void binder_latency_add(struct binder_latency_hist *hist, s64 us)
+{
+	int i;
+
+	if (us < 0)
+		us = 0;
+	if (us > UINT_MAX)
+		us = UINT_MAX;
+	i = fls((unsigned int)us);
+	if (i >= BINDER_LATENCY_BUCKETS)
+		i = BINDER_LATENCY_BUCKETS - 1;
+	hist->bucket[i]++;
+	hist->count++;
+	hist->total_us += us;
+	if (us > hist->max_us)
+		hist->max_us = us;
+}
+
 struct binder_node {
 	int debug_id;
 	struct binder_work work;
@@ -222,6 +274,7 @@ struct binder_node {
 	int internal_strong_refs;
 	int local_weak_refs;
 	int local_strong_refs;
+	int tmp_refs; /* in-flight transactions, outlive binder_deferred_release */
 	void __user *ptr;
 	void __user *cookie;
 	unsigned has_strong_ref:1;
@@ -232,6 +285,7 @@ struct binder_node {
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
 	struct list_head async_todo;
+	struct binder_latency_hist dispatch_latency;
 };
 
 struct binder_ref_death {
@@ -281,6 +335,7 @@ enum binder_deferred_state {
 
 struct binder_proc {
 	struct hlist_node proc_node;
+	struct mutex threads_lock;
 	struct rb_root threads;
 	struct rb_root nodes;
 	struct rb_root refs_by_desc;
@@ -291,15 +346,23 @@ struct binder_proc {
 	struct files_struct *files;
 	struct hlist_node deferred_work_node;
 	int deferred_work;
+	int tmp_refs; /* the file and in-flight transactions */
+	int is_dead;
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	struct mutex alloc_lock;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
 	struct page **pages;
+	unsigned long *pages_cached_map;
+	int pages_cached;
+	unsigned int pool_hits;
+	unsigned int pool_misses;
+	unsigned int pool_reclaimed;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -312,6 +375,8 @@ struct binder_proc {
 	int ready_threads;
 	long default_priority;
 	struct dentry *debugfs_entry;
+	struct binder_latency_hist dispatch_latency;
+	struct binder_latency_hist reply_latency;
 };
 
 enum {
@@ -355,10 +420,16 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	enqueue_time;
+	ktime_t	pickup_time;
 };
 
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
+static void binder_free_proc(struct binder_proc *proc);
 
 /*
  * copied from get_unused_fd_flags
@@ -607,6 +678,40 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+/*
+ * Pages released by a buffer stay mapped, both in the kernel and in the
+ * target process, and are parked in a per-proc pool so that the next
+ * buffer covering the same address does not have to allocate and map them
+ * again.  binder_shrink() gives pool pages back under memory pressure.
+ */
+static int binder_page_cached(struct binder_proc *proc, void *page_addr)
+{
+	return test_bit((page_addr - proc->buffer) / PAGE_SIZE,
+			proc->pages_cached_map);
+}
+
+static void binder_cache_page(struct binder_proc *proc, void *page_addr)
+{
+	size_t index = (page_addr - proc->buffer) / PAGE_SIZE;
+
+	BUG_ON(proc->pages[index] == NULL);
+	if (!test_and_set_bit(index, proc->pages_cached_map)) {
+		proc->pages_cached++;
+		atomic_inc(&binder_pages_cached);
+	}
+}
+
+static void binder_claim_cached_page(struct binder_proc *proc, void *page_addr)
+{
+	size_t index = (page_addr - proc->buffer) / PAGE_SIZE;
+
+	if (test_and_clear_bit(index, proc->pages_cached_map)) {
+		proc->pages_cached--;
+		atomic_dec(&binder_pages_cached);
+		proc->pool_hits++;
+	}
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -624,6 +729,21 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	if (allocate == 0) {
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+			binder_cache_page(proc, page_addr);
+		return 0;
+	}
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+		if (!binder_page_cached(proc, page_addr))
+			break;
+	if (page_addr >= end) {
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+			binder_claim_cached_page(proc, page_addr);
+		return 0;
+	}
+
 	if (vma)
 		mm = NULL;
 	else
@@ -634,9 +754,6 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		vma = proc->vma;
 	}
 
-	if (allocate == 0)
-		goto free_range;
-
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 		       "map pages in userspace, no vma\n", proc->pid);
@@ -648,7 +765,12 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
+		if (*page) {
+			BUG_ON(!binder_page_cached(proc, page_addr));
+			binder_claim_cached_page(proc, page_addr);
+			continue;
+		}
+		proc->pool_misses++;
 		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
 		if (*page == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -682,21 +804,16 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	__free_page(*page);
+	*page = NULL;
 err_alloc_page_failed:
-		;
-	}
+	/* the pages mapped so far are fine, park them in the pool */
+	for (page_addr -= PAGE_SIZE; page_addr >= start;
+	     page_addr -= PAGE_SIZE)
+		binder_cache_page(proc, page_addr);
 err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -705,9 +822,57 @@ err_no_vma:
 	return -ENOMEM;
 }
 
+/*
+ * Unmap and free up to nr_to_scan pool pages of proc.  Called with
+ * proc->alloc_lock held; gives up if the target mm is busy.
+ */
+static int binder_reclaim_cached_pages(struct binder_proc *proc,
+				       int nr_to_scan)
+{
+	struct vm_area_struct *vma = NULL;
+	struct mm_struct *mm;
+	size_t index;
+	int freed = 0;
+
+	mm = get_task_mm(proc->tsk);
+	if (mm) {
+		if (!down_write_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			return 0;
+		}
+		vma = proc->vma;
+	}
+
+	for (index = 0; index < proc->buffer_size / PAGE_SIZE &&
+	     freed < nr_to_scan; index++) {
+		void *page_addr = proc->buffer + index * PAGE_SIZE;
+
+		if (!test_and_clear_bit(index, proc->pages_cached_map))
+			continue;
+		if (vma)
+			zap_page_range(vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(proc->pages[index]);
+		proc->pages[index] = NULL;
+		proc->pages_cached--;
+		atomic_dec(&binder_pages_cached);
+		proc->pool_reclaimed++;
+		freed++;
+	}
+
+	if (mm) {
+		up_write(&mm->mmap_sem);
+		mmput(mm);
+	}
+	return freed;
+}
+
 static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 					      size_t data_size,
-					      size_t offsets_size, int is_async)
+					      size_t offsets_size, int is_async,
+					      int debug_id,
+					      struct binder_node *target_node)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -785,8 +950,17 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL))
 		return NULL;
 
+	/*
+	 * The header lives in reused memory and BC_FREE_BUFFER finds the
+	 * buffer by address as soon as it is in allocated_buffers, so it must
+	 * be fully set up before it goes there.
+	 */
 	rb_erase(best_fit, &proc->free_buffers);
 	buffer->free = 0;
+	buffer->allow_user_free = 0;
+	buffer->transaction = NULL;
+	buffer->debug_id = debug_id;
+	buffer->target_node = target_node;
 	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
 		struct binder_buffer *new_buffer = (void *)buffer->data + size;
@@ -1375,6 +1549,34 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	BUG_ON(proc->tmp_refs <= 0);
+	if (--proc->tmp_refs == 0)
+		binder_free_proc(proc);
+}
+
+/*
+ * binder_transaction() drops binder_lock while it fills the target buffer,
+ * so a failed reply may have been queued for thread in the meantime.
+ */
+static void binder_set_return_error(struct binder_thread *thread,
+				    uint32_t error_code)
+{
+	if (thread->return_error != BR_OK &&
+	    thread->return_error2 == BR_OK) {
+		thread->return_error2 = thread->return_error;
+		thread->return_error = BR_OK;
+	}
+	if (thread->return_error == BR_OK)
+		thread->return_error = error_code;
+	else
+		printk(KERN_ERR "binder: %d:%d dropped error %d, has error "
+		       "codes %d and %d already\n", thread->proc->pid,
+		       thread->pid, error_code, thread->return_error2,
+		       thread->return_error);
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
@@ -1390,6 +1592,7 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
 	uint32_t return_error;
+	int copy_failed = 0;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
@@ -1428,19 +1631,6 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
-		if (target_thread->transaction_stack != in_reply_to) {
-			binder_user_error("binder: %d:%d got reply transaction "
-				"with bad target transaction stack %d, "
-				"expected %d\n",
-				proc->pid, thread->pid,
-				target_thread->transaction_stack ?
-				target_thread->transaction_stack->debug_id : 0,
-				in_reply_to->debug_id);
-			return_error = BR_FAILED_REPLY;
-			in_reply_to = NULL;
-			target_thread = NULL;
-			goto err_dead_binder;
-		}
 		target_proc = target_thread->proc;
 	} else {
 		if (tr->target.handle) {
@@ -1481,21 +1671,8 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
 		}
 	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
 	/* TODO: reuse incoming transaction for reply */
@@ -1539,37 +1716,99 @@ static void binder_transaction(struct binder_proc *proc,
 		t->from = NULL;
 	t->sender_euid = proc->tsk->cred->euid;
 	t->to_proc = target_proc;
-	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
+	if (target_node) {
+		binder_inc_node(target_node, 1, 0, NULL);
+		target_node->tmp_refs++;
+	}
+	target_proc->tmp_refs++;
+
+	/*
+	 * Nobody else can see the buffer until t is queued, so allocate and
+	 * fill it without binder_lock.  target_proc and target_node are
+	 * pinned by their tmp_refs, which binder_deferred_release() leaves
+	 * alone; everything else is looked up again once the lock is back.
+	 */
+	mutex_unlock(&binder_lock);
+	mutex_lock(&target_proc->alloc_lock);
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
-	if (t->buffer == NULL) {
-		return_error = BR_FAILED_REPLY;
-		goto err_binder_alloc_buf_failed;
+		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY),
+		t->debug_id, target_node);
+	mutex_unlock(&target_proc->alloc_lock);
+	if (t->buffer) {
+		if (copy_from_user(t->buffer->data, tr->data.ptr.buffer,
+				   tr->data_size))
+			copy_failed = 1;
+		else if (copy_from_user(t->buffer->data +
+					ALIGN(tr->data_size, sizeof(void *)),
+					tr->data.ptr.offsets,
+					tr->offsets_size))
+			copy_failed = 2;
 	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
+	mutex_lock(&binder_lock);
 	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
-
+		target_node->tmp_refs--;
+
+	if (target_proc->is_dead || t->buffer == NULL) {
+		/* a dead target_node is on binder_dead_nodes, freed from here */
+		if (target_node)
+			binder_dec_node(target_node, 1, 0);
+		if (t->buffer == NULL) {
+			return_error = target_proc->is_dead ?
+				BR_DEAD_REPLY : BR_FAILED_REPLY;
+			goto err_binder_alloc_buf_failed;
+		}
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_target;
+	}
+	t->buffer->transaction = t;
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
-
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
+	if (copy_failed) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+			"%s ptr\n", proc->pid, thread->pid,
+			copy_failed == 1 ? "data" : "offsets");
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+
+	if (reply) {
+		target_thread = in_reply_to->from;
+		if (target_thread == NULL) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_reply;
+		}
+		if (target_thread->transaction_stack != in_reply_to) {
+			binder_user_error("binder: %d:%d got reply transaction "
+				"with bad target transaction stack %d, "
+				"expected %d\n",
+				proc->pid, thread->pid,
+				target_thread->transaction_stack ?
+				target_thread->transaction_stack->debug_id : 0,
+				in_reply_to->debug_id);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			target_thread = NULL;
+			goto err_dead_reply;
+		}
+	} else if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
+		struct binder_transaction *tmp;
+
+		for (tmp = thread->transaction_stack; tmp;
+		     tmp = tmp->from_parent)
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
 	}
+	if (target_thread) {
+		e->to_thread = target_thread->pid;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
+	}
+	t->to_thread = target_thread;
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1716,8 +1955,11 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
+	t->enqueue_time = ktime_get();
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		binder_latency_add(&proc->reply_latency,
+			ktime_us_delta(t->enqueue_time, in_reply_to->pickup_time));
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -1733,12 +1975,16 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
+	trace_binder_transaction(reply, t, target_node);
 	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
-	if (target_wait)
+	if (target_wait) {
+		trace_binder_transaction_wakeup(t, target_thread != NULL);
 		wake_up_interruptible(target_wait);
+	}
+	binder_proc_dec_tmpref(target_proc);
 	return;
 
 err_get_unused_fd_failed:
@@ -1749,11 +1995,16 @@ err_binder_get_ref_failed:
 err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
+err_dead_reply:
 err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
+err_dead_target:
+	mutex_lock(&target_proc->alloc_lock);
 	binder_free_buf(target_proc, t->buffer);
+	mutex_unlock(&target_proc->alloc_lock);
 err_binder_alloc_buf_failed:
+	binder_proc_dec_tmpref(target_proc);
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
@@ -1776,12 +2027,11 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
-	BUG_ON(thread->return_error != BR_OK);
 	if (in_reply_to) {
-		thread->return_error = BR_TRANSACTION_COMPLETE;
+		binder_set_return_error(thread, BR_TRANSACTION_COMPLETE);
 		binder_send_failed_reply(in_reply_to, return_error);
 	} else
-		thread->return_error = return_error;
+		binder_set_return_error(thread, return_error);
 }
 
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
@@ -1934,7 +2184,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			mutex_lock(&proc->alloc_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
+			mutex_unlock(&proc->alloc_lock);
 			if (buffer == NULL) {
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
@@ -1964,8 +2216,11 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				else
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
+			trace_binder_transaction_buffer_free(proc, buffer);
 			binder_transaction_buffer_release(proc, buffer, NULL);
+			mutex_lock(&proc->alloc_lock);
 			binder_free_buf(proc, buffer);
+			mutex_unlock(&proc->alloc_lock);
 			break;
 		}
 
@@ -2270,6 +2525,7 @@ retry:
 		struct binder_transaction_data tr;
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
+		s64 latency_us;
 
 		if (!list_empty(&thread->todo))
 			w = list_first_entry(&thread->todo, struct binder_work, entry);
@@ -2403,8 +2659,14 @@ retry:
 			continue;
 
 		BUG_ON(t->buffer == NULL);
+		t->pickup_time = ktime_get();
+		latency_us = ktime_us_delta(t->pickup_time, t->enqueue_time);
+		binder_latency_add(&proc->dispatch_latency, latency_us);
+		trace_binder_transaction_received(t, thread, latency_us);
 		if (t->buffer->target_node) {
 			struct binder_node *target_node = t->buffer->target_node;
+			binder_latency_add(&target_node->dispatch_latency,
+					   latency_us);
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
 			t->saved_priority = task_nice(current);
@@ -2522,6 +2784,7 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 	struct rb_node *parent = NULL;
 	struct rb_node **p = &proc->threads.rb_node;
 
+	mutex_lock(&proc->threads_lock);
 	while (*p) {
 		parent = *p;
 		thread = rb_entry(parent, struct binder_thread, rb_node);
@@ -2535,8 +2798,10 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 	}
 	if (*p == NULL) {
 		thread = kzalloc(sizeof(*thread), GFP_KERNEL);
-		if (thread == NULL)
+		if (thread == NULL) {
+			mutex_unlock(&proc->threads_lock);
 			return NULL;
+		}
 		binder_stats_created(BINDER_STAT_THREAD);
 		thread->proc = proc;
 		thread->pid = current->pid;
@@ -2548,6 +2813,7 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		thread->return_error = BR_OK;
 		thread->return_error2 = BR_OK;
 	}
+	mutex_unlock(&proc->threads_lock);
 	return thread;
 }
 
@@ -2558,7 +2824,9 @@ static int binder_free_thread(struct binder_proc *proc,
 	struct binder_transaction *send_reply = NULL;
 	int active_transactions = 0;
 
+	mutex_lock(&proc->threads_lock);
 	rb_erase(&thread->rb_node, &proc->threads);
+	mutex_unlock(&proc->threads_lock);
 	t = thread->transaction_stack;
 	if (t && t->to_thread == thread)
 		send_reply = t;
@@ -2599,12 +2867,17 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	/*
+	 * Only the calling thread can free its binder_thread, so it stays
+	 * valid here without binder_lock.  The state below is sampled
+	 * locklessly, the same way binder_has_*_work() already is.
+	 */
 	thread = binder_get_thread(proc);
+	if (thread == NULL)
+		return POLLERR;
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2833,6 +3106,12 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		failure_string = "alloc page array";
 		goto err_alloc_pages_failed;
 	}
+	proc->pages_cached_map = kzalloc(BITS_TO_LONGS((vma->vm_end - vma->vm_start) / PAGE_SIZE) * sizeof(long), GFP_KERNEL);
+	if (proc->pages_cached_map == NULL) {
+		ret = -ENOMEM;
+		failure_string = "alloc page pool map";
+		goto err_alloc_pages_cached_map_failed;
+	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
 
 	vma->vm_ops = &binder_vm_ops;
@@ -2858,6 +3137,9 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	return 0;
 
 err_alloc_small_buf_failed:
+	kfree(proc->pages_cached_map);
+	proc->pages_cached_map = NULL;
+err_alloc_pages_cached_map_failed:
 	kfree(proc->pages);
 	proc->pages = NULL;
 err_alloc_pages_failed:
@@ -2883,16 +3165,19 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	mutex_init(&proc->threads_lock);
+	mutex_init(&proc->alloc_lock);
+	proc->tmp_refs = 1;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
-	binder_stats_created(BINDER_STAT_PROC);
-	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	binder_stats_created(BINDER_STAT_PROC);
+	mutex_lock(&binder_procs_lock);
+	hlist_add_head(&proc->proc_node, &binder_procs);
+	mutex_unlock(&binder_procs_lock);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2917,6 +3202,8 @@ static void binder_deferred_flush(struct binder_proc *proc)
 {
 	struct rb_node *n;
 	int wake_count = 0;
+
+	mutex_lock(&proc->threads_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n)) {
 		struct binder_thread *thread = rb_entry(n, struct binder_thread, rb_node);
 		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
@@ -2925,6 +3212,7 @@ static void binder_deferred_flush(struct binder_proc *proc)
 			wake_count++;
 		}
 	}
+	mutex_unlock(&proc->threads_lock);
 	wake_up_interruptible_all(&proc->wait);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
@@ -2946,12 +3234,15 @@ static void binder_deferred_release(struct binder_proc *proc)
 	struct hlist_node *pos;
 	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	mutex_lock(&binder_procs_lock);
 	hlist_del(&proc->proc_node);
+	mutex_unlock(&binder_procs_lock);
+	proc->is_dead = 1;
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder_release: %d context_mgr_node gone\n",
@@ -2974,15 +3265,16 @@ static void binder_deferred_release(struct binder_proc *proc)
 		nodes++;
 		rb_erase(&node->rb_node, &proc->nodes);
 		list_del_init(&node->work.entry);
-		if (hlist_empty(&node->refs)) {
+		if (hlist_empty(&node->refs) && !node->tmp_refs) {
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		} else {
 			struct binder_ref *ref;
 			int death = 0;
 
+			/* keep the strong refs that in-flight transactions drop */
 			node->proc = NULL;
-			node->local_strong_refs = 0;
+			node->local_strong_refs = node->tmp_refs;
 			node->local_weak_refs = 0;
 			hlist_add_head(&node->dead_node, &binder_dead_nodes);
 
@@ -3014,7 +3306,8 @@ static void binder_deferred_release(struct binder_proc *proc)
 	binder_release_work(&proc->todo);
 	buffers = 0;
 
-	while ((n = rb_first(&proc->allocated_buffers))) {
+	mutex_lock(&proc->alloc_lock);
+	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n)) {
 		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
 							rb_node);
 		t = buffer->transaction;
@@ -3026,7 +3319,33 @@ static void binder_deferred_release(struct binder_proc *proc)
 			       proc->pid, t->debug_id);
 			/*BUG();*/
 		}
-		binder_free_buf(proc, buffer);
+		buffers++;
+	}
+	mutex_unlock(&proc->alloc_lock);
+
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d threads %d, nodes %d (ref %d), "
+		     "refs %d, active transactions %d, buffers %d\n",
+		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
+		     active_transactions, buffers);
+
+	/* transactions still filling a buffer here hold their own ref */
+	binder_proc_dec_tmpref(proc);
+}
+
+/*
+ * Frees the buffers and pages of a released proc once the last
+ * transaction that was filling one of its buffers has let go of it.
+ */
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct rb_node *n;
+	int buffers, page_count;
+
+	buffers = 0;
+	while ((n = rb_first(&proc->allocated_buffers))) {
+		binder_free_buf(proc, rb_entry(n, struct binder_buffer,
+					       rb_node));
 		buffers++;
 	}
 
@@ -3038,17 +3357,21 @@ static void binder_deferred_release(struct binder_proc *proc)
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
 			if (proc->pages[i]) {
 				void *page_addr = proc->buffer + i * PAGE_SIZE;
-				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-					     "binder_release: %d: "
-					     "page %d at %p not freed\n",
-					     proc->pid, i,
-					     page_addr);
+				if (test_bit(i, proc->pages_cached_map))
+					atomic_dec(&binder_pages_cached);
+				else
+					binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+						     "binder_release: %d: "
+						     "page %d at %p not freed\n",
+						     proc->pid, i,
+						     page_addr);
 				unmap_kernel_range((unsigned long)page_addr,
 					PAGE_SIZE);
 				__free_page(proc->pages[i]);
 				page_count++;
 			}
 		}
+		kfree(proc->pages_cached_map);
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
@@ -3056,11 +3379,8 @@ static void binder_deferred_release(struct binder_proc *proc)
 	put_task_struct(proc->tsk);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
-		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
-		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     "binder_release: %d freed buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
 
 	kfree(proc);
 }
@@ -3097,7 +3417,7 @@ static void binder_deferred_func(struct work_struct *work)
 			binder_deferred_flush(proc);
 
 		if (defer & BINDER_DEFERRED_RELEASE)
-			binder_deferred_release(proc); /* frees proc */
+			binder_deferred_release(proc); /* may free proc */
 
 		mutex_unlock(&binder_lock);
 		if (files)
@@ -3106,6 +3426,39 @@ static void binder_deferred_func(struct work_struct *work)
 }
 static DECLARE_WORK(binder_deferred_work, binder_deferred_func);
 
+static int binder_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int ret;
+
+	if (nr_to_scan <= 0)
+		return atomic_read(&binder_pages_cached);
+
+	/*
+	 * proc->alloc_lock is held across page allocations in
+	 * binder_alloc_buf(), so never sleep on it from reclaim.
+	 */
+	if (!mutex_trylock(&binder_procs_lock))
+		return -1;
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (nr_to_scan <= 0)
+			break;
+		if (!proc->pages_cached || !mutex_trylock(&proc->alloc_lock))
+			continue;
+		nr_to_scan -= binder_reclaim_cached_pages(proc, nr_to_scan);
+		mutex_unlock(&proc->alloc_lock);
+	}
+	ret = atomic_read(&binder_pages_cached);
+	mutex_unlock(&binder_procs_lock);
+	return ret;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer)
 {
@@ -3264,9 +3617,11 @@ static void print_binder_proc(struct seq_file *m,
 	seq_printf(m, "proc %d\n", proc->pid);
 	header_pos = m->count;
 
+	mutex_lock(&proc->threads_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		print_binder_thread(m, rb_entry(n, struct binder_thread,
 						rb_node), print_all);
+	mutex_unlock(&proc->threads_lock);
 	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
 		struct binder_node *node = rb_entry(n, struct binder_node,
 						    rb_node);
@@ -3280,9 +3635,11 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3370,11 +3727,13 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
 }
 
@@ -3384,11 +3743,14 @@ static void print_binder_proc_stats(struct seq_file *m,
 	struct binder_work *w;
 	struct rb_node *n;
 	int count, strong, weak;
+	size_t free_space, largest_free;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
+	mutex_lock(&proc->threads_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		count++;
+	mutex_unlock(&proc->threads_lock);
 	seq_printf(m, "  threads: %d\n", count);
 	seq_printf(m, "  requested threads: %d+%d/%d\n"
 			"  ready threads %d\n"
@@ -3411,11 +3773,32 @@ static void print_binder_proc_stats(struct seq_file *m,
 	}
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
+	mutex_lock(&proc->alloc_lock);
 	count = 0;
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
 
+	count = 0;
+	free_space = 0;
+	largest_free = 0;
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		size_t size = binder_buffer_size(proc, rb_entry(n,
+					struct binder_buffer, rb_node));
+		count++;
+		free_space += size;
+		if (size > largest_free)
+			largest_free = size;
+	}
+	mutex_unlock(&proc->alloc_lock);
+	seq_printf(m, "  free buffers: %d space %zd largest %zd "
+			"fragmentation %zd%%\n", count, free_space,
+			largest_free, free_space ?
+			100 - largest_free * 100 / free_space : 0);
+	seq_printf(m, "  page pool: cached %d hits %u misses %u "
+			"reclaimed %u\n", proc->pages_cached, proc->pool_hits,
+			proc->pool_misses, proc->pool_reclaimed);
+
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
 		switch (w->type) {
@@ -3449,10 +3832,14 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(node, pos, &binder_dead_nodes, dead_node)
 		print_binder_node(m, node);
 
+	if (do_lock)
+		mutex_lock(&binder_procs_lock);
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
-	if (do_lock)
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
 		mutex_unlock(&binder_lock);
+	}
 	return 0;
 }
 
@@ -3468,11 +3855,17 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
+	seq_printf(m, "pooled pages: %d\n",
+		   atomic_read(&binder_pages_cached));
 
+	if (do_lock)
+		mutex_lock(&binder_procs_lock);
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
-	if (do_lock)
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
 		mutex_unlock(&binder_lock);
+	}
 	return 0;
 }
 
@@ -3486,10 +3879,14 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 		mutex_lock(&binder_lock);
 
 	seq_puts(m, "binder transactions:\n");
+	if (do_lock)
+		mutex_lock(&binder_procs_lock);
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
-	if (do_lock)
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
 		mutex_unlock(&binder_lock);
+	}
 	return 0;
 }
 
@@ -3507,6 +3904,69 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	return 0;
 }
 
+static void print_binder_latency_hist(struct seq_file *m, const char *prefix,
+				      struct binder_latency_hist *hist)
+{
+	int i;
+
+	if (!hist->count)
+		return;
+	seq_printf(m, "%s: count %u avg %lluus max %uus\n", prefix,
+		   hist->count, div_u64(hist->total_us, hist->count),
+		   hist->max_us);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+		if (!hist->bucket[i])
+			continue;
+		if (i == BINDER_LATENCY_BUCKETS - 1)
+			seq_printf(m, "%s    >= %uus: %u\n", prefix,
+				   1U << (i - 1), hist->bucket[i]);
+		else
+			seq_printf(m, "%s    < %uus: %u\n", prefix,
+				   1U << i, hist->bucket[i]);
+	}
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	struct rb_node *n;
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock) {
+		mutex_lock(&binder_lock);
+		mutex_lock(&binder_procs_lock);
+	}
+
+	seq_puts(m, "binder latency:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (!proc->dispatch_latency.count &&
+		    !proc->reply_latency.count)
+			continue;
+		seq_printf(m, "proc %d\n", proc->pid);
+		print_binder_latency_hist(m, "  dispatch",
+					  &proc->dispatch_latency);
+		print_binder_latency_hist(m, "  reply", &proc->reply_latency);
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			struct binder_node *node = rb_entry(n,
+					struct binder_node, rb_node);
+
+			if (!node->dispatch_latency.count)
+				continue;
+			seq_printf(m, "  node %d u%p c%p\n", node->debug_id,
+				   node->ptr, node->cookie);
+			print_binder_latency_hist(m, "    dispatch",
+						  &node->dispatch_latency);
+		}
+	}
+
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		mutex_unlock(&binder_lock);
+	}
+	return 0;
+}
+
 static void print_binder_transaction_log_entry(struct seq_file *m,
 					struct binder_transaction_log_entry *e)
 {
@@ -3552,6 +4012,7 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(latency);
 
 static int __init binder_init(void)
 {
@@ -3566,6 +4027,8 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	if (!ret)
+		register_shrinker(&binder_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
@@ -3592,6 +4055,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 	}
 	return ret;
 }
@@ -21,10 +21,15 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
+#include <linux/timer.h>
+#include <linux/vmalloc.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -34,31 +39,51 @@
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * spinlock 'lock'. Nothing that can sleep, in particular no user copy, is
+ * ever done while holding it: writers stage their payload before taking the
+ * lock and readers copy their entry out to a private bounce buffer.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	spinlock_t		lock;	/* lock protecting buffer */
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	u64			w_total; /* bytes ever written */
+	unsigned int		wakeup_count;	/* entries per reader wakeup */
+	unsigned long		wakeup_delay;	/* max jiffies to defer it */
+	unsigned int		wakeup_pending;	/* entries since last wakeup */
+	struct timer_list	wakeup_timer;	/* flushes deferred wakeups */
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by log->lock, except for
+ * the bounce buffer, which belongs to whoever holds 'mutex' for the whole
+ * copy out to user-space.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes reads on this reader */
+	unsigned char		*bounce; /* one entry, copied out under lock */
 };
 
+/*
+ * Writes whose payload fits in LOGGER_STAGE_ONSTACK bytes, which is nearly
+ * all of them, are staged on the stack. Larger ones use a buffer from
+ * logger_stage_cachep, whose per-cpu object caches keep this cheap.
+ */
+#define LOGGER_STAGE_ONSTACK	256
+
+static struct kmem_cache *logger_stage_cachep;
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
@@ -89,7 +114,7 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -108,36 +133,35 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log - copies the 'count' bytes at the reader's read head from 'log'
+ * into the reader's bounce buffer and returns how many it copied. The read
+ * head is left alone.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock and reader->mutex.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static size_t do_read_log(struct logger_log *log, struct logger_reader *reader,
+			  size_t count)
 {
 	size_t len;
 
+	/* the bounce buffer holds one well-formed entry, never more */
+	if (WARN_ON_ONCE(count > LOGGER_ENTRY_MAX_LEN))
+		count = LOGGER_ENTRY_MAX_LEN;
+
 	/*
 	 * We read from the log in two disjoint operations. First, we read from
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
 	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
-		return -EFAULT;
+	memcpy(reader->bounce, log->buffer + reader->r_off, len);
 
 	/*
 	 * Second, we read any remaining bytes, starting back at the head of
 	 * the log.
 	 */
 	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
-
-	reader->r_off = logger_offset(reader->r_off + count);
+		memcpy(reader->bounce + len, log->buffer, count - len);
 
 	return count;
 }
@@ -159,6 +183,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t off, len;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -166,9 +191,9 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 		if (!ret)
 			break;
 
@@ -189,27 +214,48 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	if (mutex_lock_interruptible(&reader->mutex))
+		return -EINTR;
+
+	spin_lock(&log->lock);
 
 	/* is there still something to read or did we race? */
 	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
+	off = reader->r_off;
+	len = get_entry_len(log, off);
+	if (count < len) {
+		spin_unlock(&log->lock);
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log(log, reader, len);
+	spin_unlock(&log->lock);
 
-out:
-	mutex_unlock(&log->mutex);
+	if (copy_to_user(buf, reader->bounce, ret)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	/*
+	 * Consume the entry only now that it has reached user-space, and only
+	 * if nobody moved the read head meanwhile: a writer that lapped us has
+	 * already pulled it past this entry, as has a flush or SET_READ_OFF.
+	 */
+	spin_lock(&log->lock);
+	if (reader->r_off == off)
+		reader->r_off = logger_offset(off + len);
+	spin_unlock(&log->lock);
 
+out:
+	mutex_unlock(&reader->mutex);
 	return ret;
 }
 
@@ -217,7 +263,7 @@ out:
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -255,7 +301,7 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * We do this by "pulling forward" the readers and start head to the first
  * entry after the new write head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
@@ -274,7 +320,7 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 /*
  * do_write_log - writes 'len' bytes from 'buf' to 'log'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 {
@@ -291,44 +337,62 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
+ * logger_wakeup_timer - flushes a reader wakeup deferred by
+ * logger_note_write().
  *
- * Returns 'count' on success, negative error code on failure.
+ * This runs in softirq context while log->lock is only ever taken with
+ * spin_lock(), so it must not touch the log. The batch it flushed is
+ * retired by the next writer instead.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static void logger_wakeup_timer(unsigned long data)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	struct logger_log *log = (struct logger_log *) data;
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
-
-	log->w_off = logger_offset(log->w_off + count);
+	wake_up_interruptible(&log->wq);
+}
 
-	return count;
+/*
+ * logger_note_write - account one new entry against the log's wakeup batch.
+ * Returns nonzero if the readers should be woken right away; otherwise makes
+ * sure they are woken within wakeup_delay.
+ *
+ * The caller needs to hold log->lock.
+ */
+static int logger_note_write(struct logger_log *log)
+{
+	/* a pending batch with no timer left has been flushed by the timer */
+	if (log->wakeup_pending && !timer_pending(&log->wakeup_timer))
+		log->wakeup_pending = 0;
+
+	if (++log->wakeup_pending >= log->wakeup_count) {
+		log->wakeup_pending = 0;
+		del_timer(&log->wakeup_timer);
+		return 1;
+	}
+	if (!timer_pending(&log->wakeup_timer))
+		mod_timer(&log->wakeup_timer, jiffies + log->wakeup_delay);
+	return 0;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The payload is gathered from user-space before the log is locked, so the
+ * critical section is just two memcpy()s and writers never sleep on each
+ * other.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	unsigned char stage[LOGGER_STAGE_ONSTACK];
+	unsigned char *payload = stage;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
+	int wake;
 
 	now = current_kernel_time();
 
@@ -342,41 +406,52 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	if (header.len > sizeof(stage)) {
+		payload = kmem_cache_alloc(logger_stage_cachep, GFP_KERNEL);
+		if (unlikely(!payload))
+			return -ENOMEM;
+	}
 
-	while (nr_segs-- > 0) {
+	while (nr_segs-- > 0 && ret < header.len) {
 		size_t len;
-		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		/* stage this segment's payload */
+		if (unlikely(copy_from_user(payload + ret, iov->iov_base,
+					    len))) {
+			ret = -EFAULT;
+			goto out;
 		}
 
 		iov++;
-		ret += nr;
+		ret += len;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_lock(&log->lock);
+
+	/*
+	 * Fix up any readers, pulling them forward to the first readable
+	 * entry after (what will be) the new write offset.
+	 */
+	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+
+	do_write_log(log, &header, sizeof(struct logger_entry));
+	do_write_log(log, payload, header.len);
+	log->w_total += sizeof(struct logger_entry) + header.len;
+
+	wake = logger_note_write(log);
+
+	spin_unlock(&log->lock);
 
 	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	if (wake)
+		wake_up_interruptible(&log->wq);
+
+out:
+	if (payload != stage)
+		kmem_cache_free(logger_stage_cachep, payload);
 
 	return ret;
 }
@@ -408,13 +483,20 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->bounce = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->bounce) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
 		INIT_LIST_HEAD(&reader->list);
+		mutex_init(&reader->mutex);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -432,7 +514,12 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
+		struct logger_log *log = reader->log;
+
+		spin_lock(&log->lock);
 		list_del(&reader->list);
+		spin_unlock(&log->lock);
+		kfree(reader->bounce);
 		kfree(reader);
 	}
 
@@ -462,21 +549,101 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 	if (log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Readers may map the whole ring read-only and parse entries in place, using
+ * LOGGER_GET_RING_STATE to learn where the valid data is and
+ * LOGGER_SET_READ_OFF to hand back what they consumed. Writers keep fixing up
+ * the reader's offset exactly as for read(), so a reader that finds its
+ * offset moved forward after parsing a batch knows that the entries it
+ * parsed before the new offset may have been overwritten underneath it.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+	if (vma->vm_pgoff || size != PAGE_ALIGN(log->size))
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTCOPY;
+
+	return remap_vmalloc_range(vma, log->buffer, 0);
+}
+
+/*
+ * logger_set_read_off - move the reader forward to 'off', which must be the
+ * start of an entry in its currently readable range or the write head.
+ * Anything else would leave the read head in the middle of an entry, and
+ * read() would then take payload bytes for an entry length.
+ *
+ * Caller must hold log->lock.
+ */
+static long logger_set_read_off(struct logger_log *log,
+				struct logger_reader *reader, unsigned long off)
+{
+	size_t pos = reader->r_off;
+
+	if (off >= log->size)
+		return -EINVAL;
+	if (off != pos && !clock_interval(pos, log->w_off, off))
+		return -EINVAL;
+
+	while (pos != off) {
+		if (pos == log->w_off)
+			return -EINVAL;
+		pos = logger_offset(pos + get_entry_len(log, pos));
+	}
+
+	reader->r_off = off;
+	return 0;
+}
+
+static long logger_get_ring_state(struct logger_log *log, struct file *file,
+				  void __user *arg)
+{
+	struct logger_reader *reader = file->private_data;
+	struct logger_ring_state state;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	spin_lock(&log->lock);
+	state.size = log->size;
+	state.w_off = log->w_off;
+	state.head = log->head;
+	state.r_off = reader->r_off;
+	state.w_total = log->w_total;
+	spin_unlock(&log->lock);
+
+	if (copy_to_user(arg, &state, sizeof(state)))
+		return -EFAULT;
+	return 0;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
+	if (cmd == LOGGER_GET_RING_STATE)
+		return logger_get_ring_state(log, file, (void __user *) arg);
+
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -514,9 +681,49 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		log->head = log->w_off;
 		ret = 0;
 		break;
+	case LOGGER_SET_WAKEUP_COUNT:
+		if (!(file->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		/* the log is world writable, but this holds back every reader */
+		if (!capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			break;
+		}
+		if (!arg) {
+			ret = -EINVAL;
+			break;
+		}
+		log->wakeup_count = arg;
+		ret = 0;
+		break;
+	case LOGGER_SET_WAKEUP_DELAY:
+		if (!(file->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		if (!capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			break;
+		}
+		if (arg > LOGGER_WAKEUP_DELAY_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+		log->wakeup_delay = max(msecs_to_jiffies(arg), 1UL);
+		ret = 0;
+		break;
+	case LOGGER_SET_READ_OFF:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		ret = logger_set_read_off(log, file->private_data, arg);
+		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
@@ -526,6 +733,7 @@ static const struct file_operations logger_fops = {
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -534,13 +742,13 @@ static const struct file_operations logger_fops = {
 
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * must be a power of two, at least PAGE_SIZE, greater than
+ * LOGGER_ENTRY_MAX_LEN, and less than LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * The buffer itself is allocated by init_log() with vmalloc_user(), so that
+ * readers can map it whether or not the logger is built as a module.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -549,10 +757,14 @@ static struct logger_log VAR = { \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.wakeup_count = 1, \
+	.wakeup_delay = HZ / 10, \
+	.wakeup_timer = TIMER_INITIALIZER(logger_wakeup_timer, 0, \
+					  (unsigned long) &VAR), \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 64*1024)
@@ -577,10 +789,15 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	log->buffer = vmalloc_user(log->size);
+	if (unlikely(!log->buffer))
+		return -ENOMEM;
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		vfree(log->buffer);
 		return ret;
 	}
 
@@ -594,23 +811,41 @@ static int __init logger_init(void)
 {
 	int ret;
 
+	logger_stage_cachep = kmem_cache_create("logger_stage",
+						LOGGER_ENTRY_MAX_PAYLOAD, 0,
+						0, NULL);
+	if (unlikely(!logger_stage_cachep))
+		return -ENOMEM;
+
 	ret = init_log(&log_main);
 	if (unlikely(ret))
-		goto out;
+		goto out_cache;
 
 	ret = init_log(&log_events);
 	if (unlikely(ret))
-		goto out;
+		goto out_main;
 
 	ret = init_log(&log_radio);
 	if (unlikely(ret))
-		goto out;
+		goto out_events;
 
 	ret = init_log(&log_system);
 	if (unlikely(ret))
-		goto out;
+		goto out_radio;
 
-out:
+	return 0;
+
+out_radio:
+	misc_deregister(&log_radio.misc);
+	vfree(log_radio.buffer);
+out_events:
+	misc_deregister(&log_events.misc);
+	vfree(log_events.buffer);
+out_main:
+	misc_deregister(&log_main.misc);
+	vfree(log_main.buffer);
+out_cache:
+	kmem_cache_destroy(logger_stage_cachep);
 	return ret;
 }
 device_initcall(logger_init);
@@ -30,6 +30,20 @@ struct logger_entry {
 	char		msg[0];	/* the entry's payload */
 };
 
+/*
+ * struct logger_ring_state - where the valid data is in a mmap()ed log.
+ * Offsets are byte offsets into the ring; entries run from r_off up to
+ * w_off, wrapping at size. w_total counts every byte ever written so that
+ * readers can tell how far they were lapped.
+ */
+struct logger_ring_state {
+	__u32		size;	/* size of the ring */
+	__u32		w_off;	/* where the next entry will be written */
+	__u32		head;	/* oldest entry still in the ring */
+	__u32		r_off;	/* this reader's next entry */
+	__u64		w_total; /* bytes written since boot */
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -39,11 +53,18 @@ struct logger_entry {
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
 
+/* upper bound for LOGGER_SET_WAKEUP_DELAY, in ms */
+#define LOGGER_WAKEUP_DELAY_MAX		1000
+
 #define __LOGGERIO	0xAE
 
 #define LOGGER_GET_LOG_BUF_SIZE		_IO(__LOGGERIO, 1) /* size of log */
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_WAKEUP_COUNT		_IO(__LOGGERIO, 5) /* entries/wakeup */
+#define LOGGER_SET_WAKEUP_DELAY		_IO(__LOGGERIO, 6) /* max delay, ms */
+#define LOGGER_GET_RING_STATE		_IOR(__LOGGERIO, 7, struct logger_ring_state)
+#define LOGGER_SET_READ_OFF		_IO(__LOGGERIO, 8) /* consume to off */
 
 #endif /* _LINUX_LOGGER_H */
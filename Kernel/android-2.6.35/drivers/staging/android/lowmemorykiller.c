@@ -16,6 +16,15 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Victims are selected and killed by the "lowmemorykiller" kernel thread,
+ * which is woken when reclaim starts rather than running inside the
+ * shrinker callback.
+ *
+ * The number of passes of the kill path that looked for a victim and the
+ * total and worst-case time they took are reported, in microseconds, in
+ * kill_calls, kill_time_total_us and kill_time_max_us under the same
+ * directory.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -34,7 +43,11 @@
 #include <linux/mm.h>
 #include <linux/oom.h>
 #include <linux/sched.h>
-#include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/wait.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -52,59 +65,141 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
-static struct task_struct *lowmem_deathpending;
+/*
+ * The address space of the last victim, pinned with mm_count so that the
+ * pointer cannot be reused before lowmem_mm_release() sees it go.
+ */
+static struct mm_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_wait);
+static struct task_struct *lowmem_thread;
+static atomic_t lowmem_kill_requested = ATOMIC_INIT(0);
+
+/*
+ * Every process that owns an mm sits in the bucket matching its oom_adj, so
+ * victim selection only has to look at the highest non-empty bucket that is
+ * eligible instead of walking the whole tasklist.  Only thread group leaders
+ * are indexed, matching the for_each_process() walk this replaces.
+ */
+#define LOWMEM_NR_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static struct hlist_head lowmem_buckets[LOWMEM_NR_BUCKETS];
+
+static unsigned long lowmem_kill_calls;
+static unsigned long lowmem_kill_time_total_us;
+static unsigned long lowmem_kill_time_max_us;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
-static int
-task_notify_func(struct notifier_block *self, unsigned long val, void *data);
+static int lowmem_adj_to_bucket(int oom_adj)
+{
+	if (oom_adj < OOM_DISABLE)
+		return 0;
+	if (oom_adj > OOM_ADJUST_MAX)
+		return LOWMEM_NR_BUCKETS - 1;
+	return oom_adj - OOM_DISABLE;
+}
 
-static struct notifier_block task_nb = {
-	.notifier_call	= task_notify_func,
-};
+static void lowmem_index_insert(struct task_struct *tsk)
+{
+	int oom_adj = tsk->signal ? tsk->signal->oom_adj : 0;
+
+	if (!hlist_unhashed(&tsk->lowmem_node))
+		hlist_del(&tsk->lowmem_node);
+	hlist_add_head(&tsk->lowmem_node,
+		       &lowmem_buckets[lowmem_adj_to_bucket(oom_adj)]);
+}
 
-static int
-task_notify_func(struct notifier_block *self, unsigned long val, void *data)
+void lowmem_task_init(struct task_struct *tsk)
 {
-	struct task_struct *task = data;
+	INIT_HLIST_NODE(&tsk->lowmem_node);
+}
 
-	if (task == lowmem_deathpending)
-		lowmem_deathpending = NULL;
+void lowmem_task_add(struct task_struct *tsk)
+{
+	if (!thread_group_leader(tsk))
+		return;
 
-	return NOTIFY_OK;
+	spin_lock(&lowmem_index_lock);
+	lowmem_index_insert(tsk);
+	spin_unlock(&lowmem_index_lock);
 }
 
-static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+void lowmem_task_remove(struct task_struct *tsk)
+{
+	/* only the task itself can put itself back into the index */
+	if (hlist_unhashed(&tsk->lowmem_node))
+		return;
+
+	spin_lock(&lowmem_index_lock);
+	if (!hlist_unhashed(&tsk->lowmem_node))
+		hlist_del_init(&tsk->lowmem_node);
+	spin_unlock(&lowmem_index_lock);
+}
+
+/*
+ * Called from mmput() once the last user of an address space has unmapped
+ * it, so the victim's pages are back in the free counts the killer thread
+ * reads.  Clearing the death earlier, when the victim merely drops its mm
+ * in exit_mm(), would let the thread see the old counts and kill again.
+ */
+void lowmem_mm_release(struct mm_struct *mm)
+{
+	if (likely(ACCESS_ONCE(lowmem_deathpending) != mm))
+		return;
+
+	spin_lock(&lowmem_index_lock);
+	if (lowmem_deathpending != mm) {
+		spin_unlock(&lowmem_index_lock);
+		return;
+	}
+	lowmem_deathpending = NULL;
+	spin_unlock(&lowmem_index_lock);
+
+	wake_up(&lowmem_wait);
+	mmdrop(mm);
+}
+
+void lowmem_task_adj_changed(struct task_struct *tsk)
+{
+	spin_lock(&lowmem_index_lock);
+	if (!hlist_unhashed(&tsk->lowmem_node))
+		lowmem_index_insert(tsk);
+	spin_unlock(&lowmem_index_lock);
+}
+
+static void lowmem_account_kill(ktime_t start)
+{
+	unsigned long delta = (unsigned long)
+		ktime_us_delta(ktime_get(), start);
+
+	spin_lock(&lowmem_index_lock);
+	lowmem_kill_calls++;
+	lowmem_kill_time_total_us += delta;
+	if (delta > lowmem_kill_time_max_us)
+		lowmem_kill_time_max_us = delta;
+	spin_unlock(&lowmem_index_lock);
+}
+
+/*
+ * Translate the current vmstat counters into the lowest oom_adj that may be
+ * killed, or OOM_ADJUST_MAX + 1 when there is no memory pressure.
+ */
+static int lowmem_min_adj(int *free, int *file)
 {
-	struct task_struct *p;
-	struct task_struct *selected = NULL;
-	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
-	int selected_tasksize = 0;
-	int selected_oom_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
 
-	/*
-	 * If we already have a death outstanding, then
-	 * bail out right away; indicating to vmscan
-	 * that we have nothing further to offer on
-	 * this pass.
-	 *
-	 */
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
-		return 0;
-
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
@@ -116,68 +211,181 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			break;
 		}
 	}
-	if (nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
-			     nr_to_scan, gfp_mask, other_free, other_file,
-			     min_adj);
-	rem = global_page_state(NR_ACTIVE_ANON) +
-		global_page_state(NR_ACTIVE_FILE) +
-		global_page_state(NR_INACTIVE_ANON) +
-		global_page_state(NR_INACTIVE_FILE);
-	if (nr_to_scan <= 0 || min_adj == OOM_ADJUST_MAX + 1) {
-		lowmem_print(5, "lowmem_shrink %d, %x, return %d\n",
-			     nr_to_scan, gfp_mask, rem);
-		return rem;
-	}
-	selected_oom_adj = min_adj;
-
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+	*free = other_free;
+	*file = other_file;
+	return min_adj;
+}
+
+static bool lowmem_death_outstanding(void)
+{
+	return lowmem_deathpending &&
+	       time_before_eq(jiffies, lowmem_deathpending_timeout);
+}
+
+/*
+ * Pick the process to kill at or above min_adj and send it SIGKILL.
+ * Returns the number of pages the victim was holding, 0 if nothing was
+ * eligible.
+ */
+static int lowmem_kill_one(int min_adj)
+{
+	struct task_struct *p;
+	struct task_struct *selected = NULL;
+	struct mm_struct *selected_mm = NULL;
+	struct mm_struct *stale_mm;
+	struct hlist_node *node;
+	ktime_t start = ktime_get();
+	int tasksize;
+	int b;
+	int selected_tasksize = 0;
+	int selected_oom_adj = min_adj;
+
+	/*
+	 * Walk the buckets from the highest oom_adj down and stop at the first
+	 * one that yields a victim; within a bucket the largest RSS wins.
+	 */
+	spin_lock(&lowmem_index_lock);
+	for (b = LOWMEM_NR_BUCKETS - 1;
+	     b >= lowmem_adj_to_bucket(min_adj) && !selected; b--) {
+		hlist_for_each_entry(p, node, &lowmem_buckets[b], lowmem_node) {
+			struct mm_struct *mm;
+
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+			if (tasksize <= 0)
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			if (selected && tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = b + OOM_DISABLE;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, selected_oom_adj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
+	if (selected) {
+		task_lock(selected);
+		selected_mm = selected->mm;
+		if (selected_mm)
+			atomic_inc(&selected_mm->mm_count);
+		task_unlock(selected);
+		if (!selected_mm)
+			selected = NULL;
+	}
+	/* a timed out victim is replaced */
+	stale_mm = lowmem_deathpending;
+	lowmem_deathpending = selected_mm;
+	if (selected) {
+		get_task_struct(selected);
+		lowmem_deathpending_timeout = jiffies + HZ;
+	} else
+		selected_tasksize = 0;
+	spin_unlock(&lowmem_index_lock);
+
+	if (stale_mm)
+		mmdrop(stale_mm);
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
+		put_task_struct(selected);
 	}
-	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
+	lowmem_account_kill(start);
+	return selected_tasksize;
+}
+
+/*
+ * Victim selection runs in its own thread so that it stays off the
+ * allocation path.  The thread is woken from the shrinker and whenever
+ * kswapd is kicked for a zone below its low watermark, and after each kill
+ * it waits only until the victim's address space has been torn down before
+ * looking at the counters again.  The one second timeout remains as a
+ * backstop for a victim that is stuck on its way out.
+ */
+void lowmem_pressure_notify(void)
+{
+	if (atomic_read(&lowmem_kill_requested) || !lowmem_thread)
+		return;
+	/*
+	 * atomic_xchg() is a full barrier: either the thread sees the request
+	 * when it rechecks after queueing itself, or we see it queued here.
+	 */
+	if (atomic_xchg(&lowmem_kill_requested, 1))
+		return;
+	if (waitqueue_active(&lowmem_wait))
+		wake_up(&lowmem_wait);
+}
+
+static int lowmem_killer_thread(void *unused)
+{
+	int min_adj;
+	int other_free;
+	int other_file;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		wait_event_freezable(lowmem_wait,
+				     atomic_read(&lowmem_kill_requested) ||
+				     kthread_should_stop());
+		/* ordered before the counters are read below */
+		atomic_xchg(&lowmem_kill_requested, 0);
+
+		for (;;) {
+			if (kthread_should_stop())
+				break;
+			min_adj = lowmem_min_adj(&other_free, &other_file);
+			lowmem_print(3, "lowmem_thread ofree %d %d, ma %d\n",
+				     other_free, other_file, min_adj);
+			if (min_adj == OOM_ADJUST_MAX + 1)
+				break;
+			if (!lowmem_death_outstanding() &&
+			    !lowmem_kill_one(min_adj))
+				break;
+			wait_event_freezable_timeout(lowmem_wait,
+				!lowmem_death_outstanding() ||
+				kthread_should_stop(), HZ);
+		}
+	}
+	return 0;
+}
+
+static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+{
+	int rem;
+	int min_adj;
+	int other_free;
+	int other_file;
+
+	/*
+	 * If we already have a death outstanding, then
+	 * bail out right away; indicating to vmscan
+	 * that we have nothing further to offer on
+	 * this pass.
+	 *
+	 */
+	if (lowmem_death_outstanding())
+		return 0;
+
+	min_adj = lowmem_min_adj(&other_free, &other_file);
+	if (nr_to_scan > 0)
+		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
+			     nr_to_scan, gfp_mask, other_free, other_file,
+			     min_adj);
+	rem = global_page_state(NR_ACTIVE_ANON) +
+		global_page_state(NR_ACTIVE_FILE) +
+		global_page_state(NR_INACTIVE_ANON) +
+		global_page_state(NR_INACTIVE_FILE);
+	if (nr_to_scan > 0 && min_adj != OOM_ADJUST_MAX + 1)
+		lowmem_pressure_notify();
+	lowmem_print(5, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -188,7 +396,14 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
-	task_free_register(&task_nb);
+	lowmem_thread = kthread_run(lowmem_killer_thread, NULL,
+				    "lowmemorykiller");
+	if (IS_ERR(lowmem_thread)) {
+		int err = PTR_ERR(lowmem_thread);
+
+		lowmem_thread = NULL;
+		return err;
+	}
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -196,7 +411,8 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
-	task_free_unregister(&task_nb);
+	kthread_stop(lowmem_thread);
+	lowmem_thread = NULL;
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -205,6 +421,11 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(kill_calls, lowmem_kill_calls, ulong, S_IRUGO);
+module_param_named(kill_time_total_us, lowmem_kill_time_total_us, ulong,
+		   S_IRUGO);
+module_param_named(kill_time_max_us, lowmem_kill_time_max_us, ulong,
+		   S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -0,0 +1,328 @@
+/*
+ * Synthetic load generator for ramzswap devices
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Writes a mix of zero-filled, text-like and random pages to an already
+ * initialized ramzswap device from several threads, reads them back and
+ * verifies them, and reports throughput for both phases. The module always
+ * fails to load once the run is over, so it can simply be insmod'ed again:
+ *
+ *	rzscontrol /dev/ramzswap0 --init
+ *	insmod ramzswap_bench.ko nr_pages=8192 zero_pct=10 text_pct=60
+ *	dmesg | tail
+ *	rzscontrol /dev/ramzswap0 --reset
+ *
+ * Page 0 (the swap header) is never touched. The device must not be in use
+ * as swap while the benchmark runs.
+ */
+
+#define KMSG_COMPONENT "ramzswap_bench"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+
+static char *device = "/dev/ramzswap0";
+module_param(device, charp, 0);
+MODULE_PARM_DESC(device, "ramzswap device to drive");
+
+static unsigned int nr_pages = 4096;
+module_param(nr_pages, uint, 0);
+MODULE_PARM_DESC(nr_pages, "Number of pages to write and read back");
+
+static unsigned int threads;
+module_param(threads, uint, 0);
+MODULE_PARM_DESC(threads, "Number of I/O threads (default: online CPUs)");
+
+static unsigned int zero_pct = 10;
+module_param(zero_pct, uint, 0);
+MODULE_PARM_DESC(zero_pct, "Percentage of zero-filled pages");
+
+static unsigned int text_pct = 60;
+module_param(text_pct, uint, 0);
+MODULE_PARM_DESC(text_pct, "Percentage of text-like pages (rest random)");
+
+enum bench_kind {
+	BENCH_ZERO,
+	BENCH_TEXT,
+	BENCH_RANDOM,
+	BENCH_NR_KINDS
+};
+
+static const char *bench_kind_names[BENCH_NR_KINDS] = {
+	"zero", "text", "random"
+};
+
+static const char *bench_words[] = {
+	"the", "of", "and", "to", "in", "is", "that", "for", "page", "swap",
+	"memory", "kernel", "android", "struct", "return", "static", "int",
+	"void", "while", "buffer", "device", "compress", "data", "process",
+};
+
+struct bench_worker {
+	struct task_struct *task;
+	struct completion done;
+	struct block_device *bdev;
+	unsigned int id;
+	unsigned int nr_workers;
+	unsigned int last_page;
+	int rw;
+	unsigned int errors;
+	unsigned int mismatches;
+	unsigned int kinds[BENCH_NR_KINDS];
+};
+
+static u32 bench_next(u32 *state)
+{
+	u32 x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/*
+ * Page contents are a pure function of the page index so that the read
+ * phase can regenerate what the write phase stored.
+ */
+static enum bench_kind bench_fill(void *mem, u32 index)
+{
+	u32 state = index * 2654435761U + 1;
+	u32 pick = bench_next(&state) % 100;
+	char *p = mem, *end = p + PAGE_SIZE;
+	u32 *w;
+
+	if (pick < zero_pct) {
+		memset(mem, 0, PAGE_SIZE);
+		return BENCH_ZERO;
+	}
+
+	if (pick < zero_pct + text_pct) {
+		while (p < end) {
+			const char *word = bench_words[bench_next(&state) %
+						ARRAY_SIZE(bench_words)];
+
+			while (*word && p < end)
+				*p++ = *word++;
+			if (p < end)
+				*p++ = (bench_next(&state) & 15) ? ' ' : '\n';
+		}
+		return BENCH_TEXT;
+	}
+
+	for (w = mem; (char *)w < end; w++)
+		*w = bench_next(&state);
+	return BENCH_RANDOM;
+}
+
+static void bench_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int bench_submit(struct block_device *bdev, int rw, struct page *page,
+			u32 index)
+{
+	DECLARE_COMPLETION_ONSTACK(wait);
+	struct bio *bio;
+	int ret = 0;
+
+	bio = bio_alloc(GFP_KERNEL, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = bdev;
+	bio->bi_sector = (sector_t)index << (PAGE_SHIFT - 9);
+	bio->bi_end_io = bench_end_io;
+	bio->bi_private = &wait;
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+
+	submit_bio(rw, bio);
+	wait_for_completion(&wait);
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ret = -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+static int bench_thread(void *data)
+{
+	struct bench_worker *worker = data;
+	struct page *page, *expect = NULL;
+	void *mem, *ref;
+	enum bench_kind kind;
+	u32 index;
+
+	page = alloc_page(GFP_KERNEL);
+	if (worker->rw == READ)
+		expect = alloc_page(GFP_KERNEL);
+	if (!page || (worker->rw == READ && !expect)) {
+		worker->errors++;
+		goto out;
+	}
+
+	for (index = worker->id + 1; index <= worker->last_page;
+			index += worker->nr_workers) {
+		if (worker->rw == WRITE) {
+			mem = kmap(page);
+			kind = bench_fill(mem, index);
+			kunmap(page);
+		} else {
+			ref = kmap(expect);
+			kind = bench_fill(ref, index);
+			kunmap(expect);
+		}
+		worker->kinds[kind]++;
+
+		if (bench_submit(worker->bdev, worker->rw, page, index)) {
+			worker->errors++;
+			continue;
+		}
+
+		if (worker->rw == READ) {
+			mem = kmap(page);
+			ref = kmap(expect);
+			if (memcmp(mem, ref, PAGE_SIZE))
+				worker->mismatches++;
+			kunmap(expect);
+			kunmap(page);
+		}
+
+		cond_resched();
+	}
+
+out:
+	if (expect)
+		__free_page(expect);
+	if (page)
+		__free_page(page);
+	complete(&worker->done);
+	return 0;
+}
+
+static int bench_run_phase(struct block_device *bdev, int rw,
+			unsigned int last_page)
+{
+	struct bench_worker *workers;
+	unsigned int i, kinds[BENCH_NR_KINDS] = { 0 };
+	unsigned int errors = 0, mismatches = 0, done;
+	ktime_t start;
+	u64 ns, kbps;
+
+	workers = kcalloc(threads, sizeof(*workers), GFP_KERNEL);
+	if (!workers)
+		return -ENOMEM;
+
+	start = ktime_get();
+	for (i = 0; i < threads; i++) {
+		struct bench_worker *worker = &workers[i];
+
+		init_completion(&worker->done);
+		worker->bdev = bdev;
+		worker->id = i;
+		worker->nr_workers = threads;
+		worker->last_page = last_page;
+		worker->rw = rw;
+		worker->task = kthread_run(bench_thread, worker,
+					"rzs_bench/%u", i);
+		if (IS_ERR(worker->task)) {
+			worker->errors++;
+			complete(&worker->done);
+		}
+	}
+
+	for (i = 0; i < threads; i++)
+		wait_for_completion(&workers[i].done);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	for (i = 0; i < threads; i++) {
+		errors += workers[i].errors;
+		mismatches += workers[i].mismatches;
+		kinds[BENCH_ZERO] += workers[i].kinds[BENCH_ZERO];
+		kinds[BENCH_TEXT] += workers[i].kinds[BENCH_TEXT];
+		kinds[BENCH_RANDOM] += workers[i].kinds[BENCH_RANDOM];
+	}
+	kfree(workers);
+
+	done = kinds[BENCH_ZERO] + kinds[BENCH_TEXT] + kinds[BENCH_RANDOM];
+	kbps = ns ? div64_u64((u64)done * (PAGE_SIZE >> 10) * NSEC_PER_SEC,
+				ns) : 0;
+
+	pr_info("%s: %u pages (%s %u, %s %u, %s %u) in %llu us, "
+		"%llu KB/s, %u errors, %u mismatches\n",
+		rw == WRITE ? "write" : "read", done,
+		bench_kind_names[BENCH_ZERO], kinds[BENCH_ZERO],
+		bench_kind_names[BENCH_TEXT], kinds[BENCH_TEXT],
+		bench_kind_names[BENCH_RANDOM], kinds[BENCH_RANDOM],
+		div_u64(ns, NSEC_PER_USEC), kbps, errors, mismatches);
+
+	return (errors || mismatches) ? -EIO : 0;
+}
+
+static int __init ramzswap_bench_init(void)
+{
+	struct block_device *bdev;
+	unsigned int last_page;
+	sector_t capacity;
+	int ret;
+
+	if (zero_pct + text_pct > 100) {
+		pr_err("zero_pct + text_pct must not exceed 100\n");
+		return -EINVAL;
+	}
+
+	if (!threads)
+		threads = num_online_cpus();
+
+	bdev = open_bdev_exclusive(device, FMODE_READ | FMODE_WRITE,
+				ramzswap_bench_init);
+	if (IS_ERR(bdev)) {
+		pr_err("Error opening %s: %ld\n", device, PTR_ERR(bdev));
+		return PTR_ERR(bdev);
+	}
+
+	capacity = get_capacity(bdev->bd_disk) >> (PAGE_SHIFT - 9);
+	if (capacity < 2) {
+		pr_err("%s is not initialized\n", device);
+		ret = -ENODEV;
+		goto out;
+	}
+
+	last_page = min_t(sector_t, nr_pages, capacity - 1);
+	pr_info("%s: %u pages, %u threads, %u%% zero, %u%% text\n",
+		device, last_page, threads, zero_pct, text_pct);
+
+	ret = bench_run_phase(bdev, WRITE, last_page);
+	if (!ret)
+		ret = bench_run_phase(bdev, READ, last_page);
+
+out:
+	close_bdev_exclusive(bdev, FMODE_READ | FMODE_WRITE);
+
+	/* Nothing to keep loaded; report failure so insmod can be re-run. */
+	return ret ? ret : -EAGAIN;
+}
+
+module_init(ramzswap_bench_init);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Synthetic load generator for ramzswap devices");
@@ -23,21 +23,30 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
 #include <linux/slab.h>
 #include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/vmalloc.h>
+#include <linux/zlib.h>
 
 #include "ramzswap_drv.h"
 
 /* Globals */
 static int ramzswap_major;
 static struct ramzswap *devices;
+static struct kmem_cache *rzs_object_cache;
+static struct workqueue_struct *rzs_wb_wq;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
+static char *compressor = (char *)default_compressor;
+static int dedup = 1;
+static unsigned int writeback_idle_secs = 300;
 
 static int rzs_test_flag(struct ramzswap *rzs, u32 index,
 			enum rzs_pageflags flag)
@@ -72,6 +81,676 @@ static int page_zero_filled(void *ptr)
 	return 1;
 }
 
+static void rzs_compr_size_add(struct ramzswap *rzs, ssize_t delta)
+{
+	spin_lock(&rzs->stat64_lock);
+	rzs->stats.compr_size += delta;
+	spin_unlock(&rzs->stat64_lock);
+}
+
+static void *rzs_lzo_alloc_workmem(void)
+{
+	return kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+}
+
+static void rzs_lzo_free_workmem(void *workmem)
+{
+	kfree(workmem);
+}
+
+static int rzs_lzo_compress(void *workmem, const unsigned char *src,
+			unsigned char *dst, size_t *dst_len)
+{
+	int ret;
+
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+	return ret == LZO_E_OK ? 0 : ret;
+}
+
+static int rzs_lzo_decompress(void *workmem, const unsigned char *src,
+			size_t src_len, unsigned char *dst)
+{
+	int ret;
+	size_t dst_len = PAGE_SIZE;
+
+	ret = lzo1x_decompress_safe(src, src_len, dst, &dst_len);
+	return ret == LZO_E_OK ? 0 : ret;
+}
+
+static const struct rzs_backend rzs_lzo_backend = {
+	.name = "lzo",
+	.alloc_workmem = rzs_lzo_alloc_workmem,
+	.free_workmem = rzs_lzo_free_workmem,
+	.compress = rzs_lzo_compress,
+	.decompress = rzs_lzo_decompress,
+};
+
+#if defined(CONFIG_RAMZSWAP_ZLIB)
+/*
+ * Raw deflate (no zlib header or checksum): slower than LZO, but
+ * compresses better.
+ */
+struct rzs_zlib_workmem {
+	struct z_stream_s deflate;
+	struct z_stream_s inflate;
+};
+
+static void rzs_zlib_free_workmem(void *workmem)
+{
+	struct rzs_zlib_workmem *w = workmem;
+
+	if (w->deflate.state)
+		zlib_deflateEnd(&w->deflate);
+	if (w->inflate.state)
+		zlib_inflateEnd(&w->inflate);
+	vfree(w->deflate.workspace);
+	vfree(w->inflate.workspace);
+	kfree(w);
+}
+
+static void *rzs_zlib_alloc_workmem(void)
+{
+	struct rzs_zlib_workmem *w;
+
+	w = kzalloc(sizeof(*w), GFP_KERNEL);
+	if (!w)
+		return NULL;
+
+	w->deflate.workspace = vmalloc(zlib_deflate_workspacesize());
+	w->inflate.workspace = vmalloc(zlib_inflate_workspacesize());
+	if (!w->deflate.workspace || !w->inflate.workspace)
+		goto fail;
+
+	if (zlib_deflateInit2(&w->deflate, Z_BEST_SPEED, Z_DEFLATED,
+			-MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+		w->deflate.state = NULL;
+		goto fail;
+	}
+
+	if (zlib_inflateInit2(&w->inflate, -MAX_WBITS) != Z_OK) {
+		w->inflate.state = NULL;
+		goto fail;
+	}
+
+	return w;
+
+fail:
+	rzs_zlib_free_workmem(w);
+	return NULL;
+}
+
+static int rzs_zlib_compress(void *workmem, const unsigned char *src,
+			unsigned char *dst, size_t *dst_len)
+{
+	struct rzs_zlib_workmem *w = workmem;
+	struct z_stream_s *stream = &w->deflate;
+	int ret;
+
+	ret = zlib_deflateReset(stream);
+	if (ret != Z_OK)
+		return ret;
+
+	stream->next_in = src;
+	stream->avail_in = PAGE_SIZE;
+	stream->next_out = dst;
+	stream->avail_out = 2 * PAGE_SIZE;
+
+	ret = zlib_deflate(stream, Z_FINISH);
+	if (ret != Z_STREAM_END)
+		return ret == Z_OK ? -EOVERFLOW : ret;
+
+	*dst_len = stream->total_out;
+	return 0;
+}
+
+static int rzs_zlib_decompress(void *workmem, const unsigned char *src,
+			size_t src_len, unsigned char *dst)
+{
+	struct rzs_zlib_workmem *w = workmem;
+	struct z_stream_s *stream = &w->inflate;
+	int ret;
+
+	ret = zlib_inflateReset(stream);
+	if (ret != Z_OK)
+		return ret;
+
+	stream->next_in = src;
+	stream->avail_in = src_len;
+	stream->next_out = dst;
+	stream->avail_out = PAGE_SIZE;
+
+	ret = zlib_inflate(stream, Z_FINISH);
+	if (ret != Z_STREAM_END || stream->total_out != PAGE_SIZE)
+		return ret == Z_STREAM_END ? -EIO : ret;
+
+	return 0;
+}
+
+static const struct rzs_backend rzs_zlib_backend = {
+	.name = "zlib",
+	.alloc_workmem = rzs_zlib_alloc_workmem,
+	.free_workmem = rzs_zlib_free_workmem,
+	.compress = rzs_zlib_compress,
+	.decompress = rzs_zlib_decompress,
+	.decompress_needs_workmem = 1,
+};
+#endif /* CONFIG_RAMZSWAP_ZLIB */
+
+static const struct rzs_backend *rzs_backends[] = {
+	&rzs_lzo_backend,
+#if defined(CONFIG_RAMZSWAP_ZLIB)
+	&rzs_zlib_backend,
+#endif
+};
+
+static const struct rzs_backend *rzs_find_backend(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(rzs_backends); i++)
+		if (!strcmp(rzs_backends[i]->name, name))
+			return rzs_backends[i];
+
+	return NULL;
+}
+
+/*
+ * Grab an idle compression stream, sleeping until one is released if all
+ * of them are busy.
+ */
+static struct ramzswap_stream *rzs_stream_get(struct ramzswap *rzs)
+{
+	struct ramzswap_stream *stream;
+
+	for (;;) {
+		spin_lock(&rzs->stream_lock);
+		if (!list_empty(&rzs->idle_streams)) {
+			stream = list_first_entry(&rzs->idle_streams,
+					struct ramzswap_stream, list);
+			list_del(&stream->list);
+			spin_unlock(&rzs->stream_lock);
+			return stream;
+		}
+		spin_unlock(&rzs->stream_lock);
+
+		wait_event(rzs->stream_wait,
+			   !list_empty(&rzs->idle_streams));
+	}
+}
+
+static void rzs_stream_put(struct ramzswap *rzs,
+			struct ramzswap_stream *stream)
+{
+	spin_lock(&rzs->stream_lock);
+	list_add(&stream->list, &rzs->idle_streams);
+	spin_unlock(&rzs->stream_lock);
+
+	wake_up(&rzs->stream_wait);
+}
+
+static void rzs_destroy_streams(struct ramzswap *rzs)
+{
+	struct ramzswap_stream *stream, *tmp;
+
+	list_for_each_entry_safe(stream, tmp, &rzs->idle_streams, list) {
+		list_del(&stream->list);
+		rzs->backend->free_workmem(stream->workmem);
+		free_pages((unsigned long)stream->buffer, 1);
+		kfree(stream);
+	}
+	rzs->num_streams = 0;
+}
+
+static int rzs_create_streams(struct ramzswap *rzs, int count)
+{
+	struct ramzswap_stream *stream;
+
+	while (rzs->num_streams < count) {
+		stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+		if (!stream)
+			return -ENOMEM;
+
+		stream->workmem = rzs->backend->alloc_workmem();
+		stream->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!stream->workmem || !stream->buffer) {
+			if (stream->workmem)
+				rzs->backend->free_workmem(stream->workmem);
+			free_pages((unsigned long)stream->buffer, 1);
+			kfree(stream);
+			return -ENOMEM;
+		}
+
+		list_add(&stream->list, &rzs->idle_streams);
+		rzs->num_streams++;
+	}
+
+	return 0;
+}
+
+static void rzs_object_get(struct ramzswap *rzs, struct rzs_object *obj)
+{
+	spin_lock(&rzs->dedup_lock);
+	obj->refcount++;
+	spin_unlock(&rzs->dedup_lock);
+}
+
+/*
+ * Drop a table entry's reference to obj, freeing its storage once the
+ * last slot using it is gone.
+ */
+static void rzs_object_put(struct ramzswap *rzs, struct rzs_object *obj)
+{
+	spin_lock(&rzs->dedup_lock);
+	if (--obj->refcount) {
+		spin_unlock(&rzs->dedup_lock);
+		return;
+	}
+	if (!hlist_unhashed(&obj->hash))
+		hlist_del(&obj->hash);
+	spin_unlock(&rzs->dedup_lock);
+
+	if (unlikely(obj->size == PAGE_SIZE)) {
+		__free_page(obj->page);
+		rzs_stat_dec(rzs, &rzs->stats.objects_expand);
+	} else {
+		xv_free(rzs->mem_pool, obj->page, obj->offset);
+	}
+
+	rzs_compr_size_add(rzs, -(ssize_t)obj->size);
+	rzs_stat_dec(rzs, &rzs->stats.objects);
+	kmem_cache_free(rzs_object_cache, obj);
+}
+
+static void rzs_dedup_insert(struct ramzswap *rzs, struct rzs_object *obj)
+{
+	spin_lock(&rzs->dedup_lock);
+	hlist_add_head(&obj->hash,
+		&rzs->dedup_table[obj->checksum & rzs->dedup_mask]);
+	spin_unlock(&rzs->dedup_lock);
+}
+
+/* Compare page with the contents of obj, decompressing if needed. */
+static int rzs_dedup_same(struct ramzswap *rzs, struct rzs_object *obj,
+			struct page *page, struct ramzswap_stream *stream)
+{
+	int same;
+	unsigned char *user_mem, *cmem, *data;
+
+	cmem = kmap_atomic(obj->page, KM_USER1) + obj->offset;
+	if (unlikely(obj->size == PAGE_SIZE)) {
+		data = cmem;
+		same = 1;
+	} else {
+		data = stream->buffer;
+		same = !rzs->backend->decompress(stream->workmem,
+				cmem + sizeof(struct zobj_header),
+				obj->size, data);
+	}
+
+	if (same) {
+		user_mem = kmap_atomic(page, KM_USER0);
+		same = !memcmp(user_mem, data, PAGE_SIZE);
+		kunmap_atomic(user_mem, KM_USER0);
+	}
+	kunmap_atomic(cmem, KM_USER1);
+
+	return same;
+}
+
+/*
+ * Look for a stored object with the same contents as page and take a
+ * reference to it. Checksums only select the candidates; the contents are
+ * compared in full, and on a mismatch the rest of the chain is searched.
+ * The candidate being compared is held by a reference, which also keeps
+ * it hashed, so the walk can go on from it once the lock is retaken.
+ */
+static struct rzs_object *rzs_dedup_find(struct ramzswap *rzs,
+			u32 checksum, struct page *page,
+			struct ramzswap_stream *stream)
+{
+	struct hlist_node *pos;
+	struct rzs_object *obj, *found, *prev = NULL;
+
+	for (;;) {
+		found = NULL;
+		spin_lock(&rzs->dedup_lock);
+		if (prev)
+			pos = prev->hash.next;
+		else
+			pos = rzs->dedup_table[checksum & rzs->dedup_mask].first;
+		hlist_for_each_entry_from(obj, pos, hash) {
+			if (obj->checksum == checksum) {
+				obj->refcount++;
+				found = obj;
+				break;
+			}
+		}
+		spin_unlock(&rzs->dedup_lock);
+
+		if (prev)
+			rzs_object_put(rzs, prev);
+		if (!found || rzs_dedup_same(rzs, found, page, stream))
+			return found;
+		prev = found;
+	}
+}
+
+static int rzs_backing_alloc(struct ramzswap *rzs, unsigned long *slot)
+{
+	unsigned long pos;
+
+	spin_lock(&rzs->wb_lock);
+	pos = find_next_zero_bit(rzs->backing_map, rzs->backing_pages,
+				rzs->backing_next);
+	if (pos >= rzs->backing_pages)
+		pos = find_first_zero_bit(rzs->backing_map,
+					rzs->backing_pages);
+	if (pos >= rzs->backing_pages) {
+		spin_unlock(&rzs->wb_lock);
+		return -ENOSPC;
+	}
+	set_bit(pos, rzs->backing_map);
+	rzs->backing_next = pos + 1;
+	spin_unlock(&rzs->wb_lock);
+
+	*slot = pos;
+	return 0;
+}
+
+static void rzs_backing_free(struct ramzswap *rzs, unsigned long slot)
+{
+	spin_lock(&rzs->wb_lock);
+	clear_bit(slot, rzs->backing_map);
+	spin_unlock(&rzs->wb_lock);
+}
+
+/*
+ * Queue the object stored for table entry index for writeback. The
+ * caller passes in a reference to obj, which the queue then owns.
+ * Returns 0 if the queue is full.
+ */
+static int rzs_wb_queue(struct ramzswap *rzs, struct rzs_object *obj,
+			u32 index)
+{
+	struct rzs_wb_io *io;
+	unsigned int count;
+
+	spin_lock(&rzs->wb_lock);
+	if (rzs->wb_count == RZS_WB_QUEUE_LEN) {
+		spin_unlock(&rzs->wb_lock);
+		rzs_object_put(rzs, obj);
+		return 0;
+	}
+	io = &rzs->wb_queue[(rzs->wb_head + rzs->wb_count) %
+				RZS_WB_QUEUE_LEN];
+	io->obj = obj;
+	io->index = index;
+	count = ++rzs->wb_count;
+	spin_unlock(&rzs->wb_lock);
+
+	/* Give the queue a moment to fill up into a full batch */
+	queue_delayed_work(rzs_wb_wq, &rzs->wb_work,
+			count >= RZS_WB_BATCH ? 0 : HZ / 10);
+	return 1;
+}
+
+static int rzs_wb_dequeue(struct ramzswap *rzs)
+{
+	int count = 0;
+
+	spin_lock(&rzs->wb_lock);
+	while (rzs->wb_count && count < RZS_WB_BATCH) {
+		rzs->wb_batch[count++] = rzs->wb_queue[rzs->wb_head];
+		rzs->wb_head = (rzs->wb_head + 1) % RZS_WB_QUEUE_LEN;
+		rzs->wb_count--;
+	}
+	spin_unlock(&rzs->wb_lock);
+
+	return count;
+}
+
+static void rzs_wb_end_io(struct bio *bio, int err)
+{
+	struct rzs_wb_io *io = bio->bi_private;
+	struct ramzswap *rzs = io->rzs;
+
+	if (!err && !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		err = -EIO;
+	io->error = err;
+
+	if (atomic_dec_and_test(&rzs->wb_pending))
+		complete(&rzs->wb_done);
+}
+
+/*
+ * Prepare the page to write for io: incompressible pages are written
+ * straight from their object, compressed ones are decompressed into a
+ * new page so that reads can be served by the backing device directly.
+ */
+static int rzs_wb_prepare(struct ramzswap *rzs, struct rzs_wb_io *io,
+			struct ramzswap_stream **stream)
+{
+	struct rzs_object *obj = io->obj;
+	unsigned char *cmem, *user_mem;
+	int ret;
+
+	if (rzs_backing_alloc(rzs, &io->slot))
+		return -ENOSPC;
+
+	if (obj->size == PAGE_SIZE) {
+		io->page = obj->page;
+	} else {
+		io->page = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (!io->page)
+			return -ENOMEM;
+
+		if (!*stream)
+			*stream = rzs_stream_get(rzs);
+
+		user_mem = kmap_atomic(io->page, KM_USER0);
+		cmem = kmap_atomic(obj->page, KM_USER1) + obj->offset;
+		ret = rzs->backend->decompress((*stream)->workmem,
+				cmem + sizeof(struct zobj_header),
+				obj->size, user_mem);
+		kunmap_atomic(user_mem, KM_USER0);
+		kunmap_atomic(cmem, KM_USER1);
+		if (ret)
+			return -EIO;
+	}
+
+	io->bio = bio_alloc(GFP_NOIO, 1);
+	if (!io->bio)
+		return -ENOMEM;
+
+	io->bio->bi_bdev = rzs->backing_bdev;
+	io->bio->bi_sector = (sector_t)io->slot << SECTORS_PER_PAGE_SHIFT;
+	io->bio->bi_end_io = rzs_wb_end_io;
+	io->bio->bi_private = io;
+	bio_add_page(io->bio, io->page, PAGE_SIZE, 0);
+
+	return 0;
+}
+
+/*
+ * Switch io's table entry over to its backing slot, unless the entry was
+ * freed or rewritten while the write was in flight.
+ */
+static void rzs_wb_finish(struct ramzswap *rzs, struct rzs_wb_io *io)
+{
+	struct rzs_object *obj = io->obj;
+	int uncompressed;
+
+	if (io->bio)
+		bio_put(io->bio);
+	if (io->page && io->page != obj->page)
+		__free_page(io->page);
+
+	if (io->error) {
+		if (io->slot != ULONG_MAX)
+			rzs_backing_free(rzs, io->slot);
+		rzs_stat64_inc(rzs, &rzs->stats.wb_failed);
+		rzs_object_put(rzs, obj);
+		return;
+	}
+
+	spin_lock(&rzs->dedup_lock);
+	if (rzs_test_flag(rzs, io->index, RZS_BACKED) ||
+			rzs->table[io->index].obj != obj) {
+		spin_unlock(&rzs->dedup_lock);
+		rzs_backing_free(rzs, io->slot);
+		rzs_object_put(rzs, obj);
+		return;
+	}
+	uncompressed = rzs_test_flag(rzs, io->index, RZS_UNCOMPRESSED);
+	rzs_clear_flag(rzs, io->index, RZS_UNCOMPRESSED);
+	rzs_set_flag(rzs, io->index, RZS_BACKED);
+	rzs->table[io->index].slot = io->slot;
+	spin_unlock(&rzs->dedup_lock);
+
+	if (uncompressed)
+		rzs_stat_dec(rzs, &rzs->stats.pages_expand);
+	else if (obj->size <= PAGE_SIZE / 2)
+		rzs_stat_dec(rzs, &rzs->stats.good_compress);
+	rzs_stat_dec(rzs, &rzs->stats.pages_stored);
+	rzs_stat_inc(rzs, &rzs->stats.pages_backed);
+	rzs_stat64_inc(rzs, &rzs->stats.wb_written);
+
+	/* Drop the table entry's reference, then the queue's */
+	rzs_object_put(rzs, obj);
+	rzs_object_put(rzs, obj);
+}
+
+/*
+ * Write out one batch. Slots are handed out sequentially, so a batch
+ * usually lands on consecutive backing pages and gets merged into a few
+ * large requests.
+ */
+static void rzs_writeback_batch(struct ramzswap *rzs, int count)
+{
+	struct ramzswap_stream *stream = NULL;
+	struct rzs_wb_io *io;
+	int i, submitted = 0;
+
+	for (i = 0; i < count; i++) {
+		io = &rzs->wb_batch[i];
+		io->rzs = rzs;
+		io->slot = ULONG_MAX;
+		io->page = NULL;
+		io->bio = NULL;
+		io->error = rzs_wb_prepare(rzs, io, &stream);
+		if (!io->error)
+			submitted++;
+	}
+
+	if (stream)
+		rzs_stream_put(rzs, stream);
+
+	if (submitted) {
+		INIT_COMPLETION(rzs->wb_done);
+		atomic_set(&rzs->wb_pending, submitted);
+		for (i = 0; i < count; i++) {
+			io = &rzs->wb_batch[i];
+			if (!io->error)
+				submit_bio(WRITE, io->bio);
+		}
+		wait_for_completion(&rzs->wb_done);
+	}
+
+	for (i = 0; i < count; i++)
+		rzs_wb_finish(rzs, &rzs->wb_batch[i]);
+}
+
+static void rzs_writeback_work(struct work_struct *work)
+{
+	struct ramzswap *rzs = container_of(to_delayed_work(work),
+					struct ramzswap, wb_work);
+	int count;
+
+	while ((count = rzs_wb_dequeue(rzs)))
+		rzs_writeback_batch(rzs, count);
+}
+
+/*
+ * Look for pages not read or written for writeback_idle_secs, a chunk of
+ * the table at a time. Pages shared through dedup are left alone.
+ */
+static void rzs_writeback_scan(struct work_struct *work)
+{
+	struct ramzswap *rzs = container_of(to_delayed_work(work),
+					struct ramzswap, wb_scan_work);
+	unsigned long age = (unsigned long)writeback_idle_secs * HZ;
+	size_t num_pages = rzs->disksize >> PAGE_SHIFT;
+	struct rzs_object *obj;
+	u32 index;
+	int i;
+
+	for (i = 0; age && i < RZS_WB_SCAN_CHUNK; i++) {
+		index = rzs->wb_scan_index;
+		if (++rzs->wb_scan_index >= num_pages)
+			rzs->wb_scan_index = 1;	/* skip the swap header */
+
+		obj = NULL;
+		spin_lock(&rzs->dedup_lock);
+		if (!rzs_test_flag(rzs, index, RZS_BACKED)) {
+			obj = rzs->table[index].obj;
+			if (obj && obj->refcount == 1 &&
+					time_after(jiffies, obj->atime + age))
+				obj->refcount++;
+			else
+				obj = NULL;
+		}
+		spin_unlock(&rzs->dedup_lock);
+
+		if (obj && !rzs_wb_queue(rzs, obj, index))
+			break;
+	}
+
+	queue_delayed_work(rzs_wb_wq, &rzs->wb_scan_work,
+			writeback_scan_interval);
+}
+
+static int rzs_setup_backing(struct ramzswap *rzs)
+{
+	struct block_device *bdev;
+	size_t map_size;
+
+	bdev = open_bdev_exclusive(rzs->backing_name,
+				FMODE_READ | FMODE_WRITE, rzs);
+	if (IS_ERR(bdev)) {
+		pr_err("Error opening backing device %s: %ld\n",
+			rzs->backing_name, PTR_ERR(bdev));
+		return PTR_ERR(bdev);
+	}
+	rzs->backing_bdev = bdev;
+
+	rzs->backing_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (!rzs->backing_pages) {
+		pr_err("Backing device %s is empty\n", rzs->backing_name);
+		return -EINVAL;
+	}
+
+	map_size = BITS_TO_LONGS(rzs->backing_pages) * sizeof(long);
+	rzs->backing_map = vmalloc(map_size);
+	rzs->wb_queue = kcalloc(RZS_WB_QUEUE_LEN, sizeof(*rzs->wb_queue),
+				GFP_KERNEL);
+	rzs->wb_batch = kcalloc(RZS_WB_BATCH, sizeof(*rzs->wb_batch),
+				GFP_KERNEL);
+	if (!rzs->backing_map || !rzs->wb_queue || !rzs->wb_batch) {
+		pr_err("Error allocating writeback state\n");
+		return -ENOMEM;
+	}
+	memset(rzs->backing_map, 0, map_size);
+
+	rzs->backing_next = 0;
+	rzs->wb_head = 0;
+	rzs->wb_count = 0;
+	rzs->wb_scan_index = 1;
+
+	pr_info("Using %s as backing device (%lu pages)\n",
+		rzs->backing_name, rzs->backing_pages);
+	return 0;
+}
+
 static void ramzswap_set_disksize(struct ramzswap *rzs, size_t totalram_bytes)
 {
 	if (!rzs->disksize) {
@@ -116,8 +795,10 @@ static void setup_swap_header(struct ramzswap *rzs, union swap_header *s)
 }
 
 static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
-			struct ramzswap_ioctl_stats *s)
+			struct ramzswap_ioctl_stats_ext *e)
 {
+	struct ramzswap_ioctl_stats *s = &e->base;
+
 	s->disksize = rzs->disksize;
 
 #if defined(CONFIG_RAMZSWAP_STATS)
@@ -127,7 +808,7 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	unsigned int good_compress_perc = 0, no_compress_perc = 0;
 
 	mem_used = xv_get_total_size_bytes(rzs->mem_pool)
-			+ (rs->pages_expand << PAGE_SHIFT);
+			+ (rs->objects_expand << PAGE_SHIFT);
 	succ_writes = rzs_stat64_read(rzs, &rs->num_writes) -
 			rzs_stat64_read(rzs, &rs->failed_writes);
 
@@ -154,52 +835,65 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	s->orig_data_size = rs->pages_stored << PAGE_SHIFT;
 	s->compr_data_size = rs->compr_size;
 	s->mem_used_total = mem_used;
+
+	e->dedup_hits = rzs_stat64_read(rzs, &rs->dedup_hits);
+	e->pages_dedup = rs->pages_stored - rs->objects;
+	if (s->orig_data_size)
+		e->compr_ratio_pct = div64_u64(s->compr_data_size * 100,
+						s->orig_data_size);
+
+	e->wb_written = rzs_stat64_read(rzs, &rs->wb_written);
+	e->wb_read = rzs_stat64_read(rzs, &rs->wb_read);
+	e->wb_failed = rzs_stat64_read(rzs, &rs->wb_failed);
+	e->pages_backed = rs->pages_backed;
 	}
 #endif /* CONFIG_RAMZSWAP_STATS */
+
+	strlcpy(e->compressor, rzs->backend->name, sizeof(e->compressor));
 }
 
 static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
-	u32 clen;
-	void *obj;
-
-	struct page *page = rzs->table[index].page;
-	u32 offset = rzs->table[index].offset;
+	struct rzs_object *obj;
+	unsigned long slot;
+
+	spin_lock(&rzs->dedup_lock);
+	if (unlikely(rzs_test_flag(rzs, index, RZS_BACKED))) {
+		slot = rzs->table[index].slot;
+		rzs_clear_flag(rzs, index, RZS_BACKED);
+		rzs->table[index].obj = NULL;
+		spin_unlock(&rzs->dedup_lock);
+
+		rzs_backing_free(rzs, slot);
+		rzs_stat_dec(rzs, &rzs->stats.pages_backed);
+		return;
+	}
+	obj = rzs->table[index].obj;
+	rzs->table[index].obj = NULL;
+	spin_unlock(&rzs->dedup_lock);
 
-	if (unlikely(!page)) {
+	if (unlikely(!obj)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
 		 */
 		if (rzs_test_flag(rzs, index, RZS_ZERO)) {
 			rzs_clear_flag(rzs, index, RZS_ZERO);
-			rzs_stat_dec(&rzs->stats.pages_zero);
+			rzs_stat_dec(rzs, &rzs->stats.pages_zero);
 		}
 		return;
 	}
 
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
 		rzs_clear_flag(rzs, index, RZS_UNCOMPRESSED);
-		rzs_stat_dec(&rzs->stats.pages_expand);
-		goto out;
+		rzs_stat_dec(rzs, &rzs->stats.pages_expand);
+	} else if (obj->size <= PAGE_SIZE / 2) {
+		rzs_stat_dec(rzs, &rzs->stats.good_compress);
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(rzs->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		rzs_stat_dec(&rzs->stats.good_compress);
+	rzs_stat_dec(rzs, &rzs->stats.pages_stored);
 
-out:
-	rzs->stats.compr_size -= clen;
-	rzs_stat_dec(&rzs->stats.pages_stored);
-
-	rzs->table[index].page = NULL;
-	rzs->table[index].offset = 0;
+	rzs_object_put(rzs, obj);
 }
 
 static int handle_zero_page(struct bio *bio)
@@ -218,18 +912,15 @@ static int handle_zero_page(struct bio *bio)
 	return 0;
 }
 
-static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
+static int handle_uncompressed_page(struct rzs_object *obj, struct bio *bio)
 {
-	u32 index;
 	struct page *page;
 	unsigned char *user_mem, *cmem;
 
 	page = bio->bi_io_vec[0].bv_page;
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	cmem = kmap_atomic(obj->page, KM_USER1) + obj->offset;
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -263,11 +954,12 @@ static int handle_ramzswap_fault(struct ramzswap *rzs, struct bio *bio)
 
 static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 {
-	int ret;
+	int ret, uncompressed;
 	u32 index;
-	size_t clen;
 	struct page *page;
+	struct rzs_object *obj;
 	struct zobj_header *zheader;
+	struct ramzswap_stream *stream = NULL;
 	unsigned char *user_mem, *cmem;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
@@ -278,33 +970,70 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	if (rzs_test_flag(rzs, index, RZS_ZERO))
 		return handle_zero_page(bio);
 
+	/*
+	 * With writeback enabled the entry may be switched to a backing
+	 * slot at any time, so pin the object while using it.  Its flags
+	 * are only stable under dedup_lock: rzs_wb_finish() clears
+	 * RZS_UNCOMPRESSED when it switches the entry over, while we may
+	 * still be reading the pinned object.
+	 */
+	if (rzs->backing_bdev) {
+		spin_lock(&rzs->dedup_lock);
+		if (rzs_test_flag(rzs, index, RZS_BACKED)) {
+			sector_t slot = rzs->table[index].slot;
+
+			spin_unlock(&rzs->dedup_lock);
+			rzs_stat64_inc(rzs, &rzs->stats.wb_read);
+
+			/* Stored as-is: remap to the backing device */
+			bio->bi_bdev = rzs->backing_bdev;
+			bio->bi_sector = slot << SECTORS_PER_PAGE_SHIFT;
+			return 1;
+		}
+		obj = rzs->table[index].obj;
+		if (obj)
+			obj->refcount++;
+		uncompressed = rzs_test_flag(rzs, index, RZS_UNCOMPRESSED);
+		spin_unlock(&rzs->dedup_lock);
+	} else {
+		obj = rzs->table[index].obj;
+		uncompressed = rzs_test_flag(rzs, index, RZS_UNCOMPRESSED);
+	}
+
 	/* Requested page is not present in compressed area */
-	if (!rzs->table[index].page)
+	if (!obj)
 		return handle_ramzswap_fault(rzs, bio);
 
+	obj->atime = jiffies;
+
 	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		return handle_uncompressed_page(rzs, bio);
+	if (unlikely(uncompressed)) {
+		ret = handle_uncompressed_page(obj, bio);
+		goto out;
+	}
 
-	user_mem = kmap_atomic(page, KM_USER0);
-	clen = PAGE_SIZE;
+	if (rzs->backend->decompress_needs_workmem)
+		stream = rzs_stream_get(rzs);
 
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = kmap_atomic(obj->page, KM_USER1) + obj->offset;
 
-	ret = lzo1x_decompress_safe(
-		cmem + sizeof(*zheader),
-		xv_get_object_size(cmem) - sizeof(*zheader),
-		user_mem, &clen);
+	ret = rzs->backend->decompress(stream ? stream->workmem : NULL,
+			cmem + sizeof(*zheader), obj->size, user_mem);
 
 	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
 
+	if (stream)
+		rzs_stream_put(rzs, stream);
+
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
+		bio_io_error(bio);
+		ret = 0;
 		goto out;
 	}
 
@@ -312,20 +1041,23 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
-	return 0;
 
 out:
-	bio_io_error(bio);
-	return 0;
+	if (rzs->backing_bdev)
+		rzs_object_put(rzs, obj);
+	return ret;
 }
 
 static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
-	u32 offset, index;
+	u32 offset, index, checksum = 0;
+	int writeback = 0;
 	size_t clen;
 	struct zobj_header *zheader;
 	struct page *page, *page_store;
+	struct ramzswap_stream *stream;
+	struct rzs_object *obj;
 	unsigned char *user_mem, *cmem, *src;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_writes);
@@ -333,15 +1065,19 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	src = rzs->compress_buffer;
-
-	mutex_lock(&rzs->lock);
+	/*
+	 * Swap frees a slot (swap_slot_free_notify) before writing it again,
+	 * but other writers, like ramzswap_bench, overwrite it directly.  Drop
+	 * the old object and flags first, or the object leaks and a stale
+	 * RZS_ZERO or RZS_UNCOMPRESSED misreads the new data.
+	 */
+	if (rzs->table[index].obj || rzs->table[index].flags)
+		ramzswap_free_page(rzs, index);
 
 	user_mem = kmap_atomic(page, KM_USER0);
 	if (page_zero_filled(user_mem)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs->lock);
-		rzs_stat_inc(&rzs->stats.pages_zero);
+		rzs_stat_inc(rzs, &rzs->stats.pages_zero);
 		rzs_set_flag(rzs, index, RZS_ZERO);
 
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
@@ -349,13 +1085,43 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		return 0;
 	}
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	if (rzs->dedup_table)
+		checksum = jhash2((u32 *)user_mem, PAGE_SIZE / sizeof(u32), 0);
 
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	stream = rzs_stream_get(rzs);
+
+	if (rzs->dedup_table) {
+		obj = rzs_dedup_find(rzs, checksum, page, stream);
+		if (obj) {
+			rzs_stream_put(rzs, stream);
+			rzs_stat64_inc(rzs, &rzs->stats.dedup_hits);
+			goto found;
+		}
+	}
+
+	obj = kmem_cache_alloc(rzs_object_cache, GFP_NOIO);
+	if (unlikely(!obj)) {
+		rzs_stream_put(rzs, stream);
+		pr_info("Error allocating object for page: %u\n", index);
+		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
+		goto out;
+	}
+	INIT_HLIST_NODE(&obj->hash);
+	obj->checksum = checksum;
+	obj->refcount = 1;
+	obj->index = index;
+
+	src = stream->buffer;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = rzs->backend->compress(stream->workmem, user_mem, src, &clen);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret)) {
+		rzs_stream_put(rzs, stream);
+		kmem_cache_free(rzs_object_cache, obj);
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
@@ -370,7 +1136,8 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
-			mutex_unlock(&rzs->lock);
+			rzs_stream_put(rzs, stream);
+			kmem_cache_free(rzs_object_cache, obj);
 			pr_info("Error allocating memory for incompressible "
 				"page: %u\n", index);
 			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
@@ -378,17 +1145,20 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		}
 
 		offset = 0;
-		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
-		rzs_stat_inc(&rzs->stats.pages_expand);
-		rzs->table[index].page = page_store;
+		obj->page = page_store;
+		rzs_stat_inc(rzs, &rzs->stats.objects_expand);
 		src = kmap_atomic(page, KM_USER0);
+
+		/* Keeping it in RAM saves nothing: move it to disk */
+		writeback = rzs->backing_bdev && index;
 		goto memstore;
 	}
 
 	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
-			&rzs->table[index].page, &offset,
+			&obj->page, &offset,
 			GFP_NOIO | __GFP_HIGHMEM)) {
-		mutex_unlock(&rzs->lock);
+		rzs_stream_put(rzs, stream);
+		kmem_cache_free(rzs_object_cache, obj);
 		pr_info("Error allocating memory for compressed "
 			"page: %u, size=%zu\n", index, clen);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
@@ -396,14 +1166,14 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	}
 
 memstore:
-	rzs->table[index].offset = offset;
+	obj->offset = offset;
+	obj->size = clen;
 
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	cmem = kmap_atomic(obj->page, KM_USER1) + obj->offset;
 
 #if 0
 	/* Back-reference needed for memory defragmentation */
-	if (!rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) {
+	if (clen != PAGE_SIZE) {
 		zheader = (struct zobj_header *)cmem;
 		zheader->table_idx = index;
 		cmem += sizeof(*zheader);
@@ -413,16 +1183,34 @@ memstore:
 	memcpy(cmem, src, clen);
 
 	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
+	if (unlikely(clen == PAGE_SIZE))
 		kunmap_atomic(src, KM_USER0);
 
+	rzs_stream_put(rzs, stream);
+
+	rzs_compr_size_add(rzs, clen);
+	rzs_stat_inc(rzs, &rzs->stats.objects);
+
+	if (rzs->dedup_table)
+		rzs_dedup_insert(rzs, obj);
+
+found:
+	obj->atime = jiffies;
+	rzs->table[index].obj = obj;
+
 	/* Update stats */
-	rzs->stats.compr_size += clen;
-	rzs_stat_inc(&rzs->stats.pages_stored);
-	if (clen <= PAGE_SIZE / 2)
-		rzs_stat_inc(&rzs->stats.good_compress);
+	if (unlikely(obj->size == PAGE_SIZE)) {
+		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
+		rzs_stat_inc(rzs, &rzs->stats.pages_expand);
+	} else if (obj->size <= PAGE_SIZE / 2) {
+		rzs_stat_inc(rzs, &rzs->stats.good_compress);
+	}
+	rzs_stat_inc(rzs, &rzs->stats.pages_stored);
 
-	mutex_unlock(&rzs->lock);
+	if (writeback) {
+		rzs_object_get(rzs, obj);
+		rzs_wb_queue(rzs, obj, index);
+	}
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
@@ -453,7 +1241,8 @@ static inline int valid_swap_request(struct ramzswap *rzs, struct bio *bio)
 }
 
 /*
- * Handler function for all ramzswap I/O requests.
+ * Handler function for all ramzswap I/O requests. Returns nonzero when
+ * the bio was remapped to the backing device and must be resubmitted.
  */
 static int ramzswap_make_request(struct request_queue *queue, struct bio *bio)
 {
@@ -491,33 +1280,43 @@ static void reset_device(struct ramzswap *rzs)
 	/* Do not accept any new I/O request */
 	rzs->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
+	/* Let writeback finish; it holds object references and streams */
+	cancel_delayed_work_sync(&rzs->wb_scan_work);
+	flush_delayed_work(&rzs->wb_work);
 
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
+	/* Free various per-device buffers */
+	if (rzs->backend)
+		rzs_destroy_streams(rzs);
 
 	/* Free all pages that are still in this ramzswap device */
-	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = rzs->table[index].page;
-		offset = rzs->table[index].offset;
+	for (index = 0; rzs->table &&
+			index < rzs->disksize >> PAGE_SHIFT; index++) {
+		struct rzs_object *obj = rzs->table[index].obj;
 
-		if (!page)
-			continue;
-
-		if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(rzs->mem_pool, page, offset);
+		if (obj && !rzs_test_flag(rzs, index, RZS_BACKED))
+			rzs_object_put(rzs, obj);
 	}
 
 	vfree(rzs->table);
 	rzs->table = NULL;
 
+	vfree(rzs->dedup_table);
+	rzs->dedup_table = NULL;
+	rzs->backend = NULL;
+
+	if (rzs->backing_bdev)
+		close_bdev_exclusive(rzs->backing_bdev,
+				FMODE_READ | FMODE_WRITE);
+	rzs->backing_bdev = NULL;
+	rzs->backing_name[0] = '\0';
+
+	vfree(rzs->backing_map);
+	rzs->backing_map = NULL;
+	kfree(rzs->wb_queue);
+	rzs->wb_queue = NULL;
+	kfree(rzs->wb_batch);
+	rzs->wb_batch = NULL;
+
 	xv_destroy_pool(rzs->mem_pool);
 	rzs->mem_pool = NULL;
 
@@ -534,24 +1333,29 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	struct page *page;
 	union swap_header *swap_header;
 
+	mutex_lock(&rzs->lock);
+
 	if (rzs->init_done) {
+		mutex_unlock(&rzs->lock);
 		pr_info("Device already initialized!\n");
 		return -EBUSY;
 	}
 
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
+	if (!rzs->backend) {
+		rzs->backend = rzs_find_backend(compressor);
+		if (!rzs->backend) {
+			pr_err("Unknown compressor: %s\n", compressor);
+			ret = -EINVAL;
+			goto fail;
+		}
 	}
+	pr_info("Using %s compressor\n", rzs->backend->name);
 
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = rzs_create_streams(rzs, num_online_cpus());
+	if (ret) {
+		pr_err("Error allocating compression streams!\n");
 		goto fail;
 	}
 
@@ -566,15 +1370,48 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	}
 	memset(rzs->table, 0, num_pages * sizeof(*rzs->table));
 
+	if (dedup) {
+		size_t buckets = roundup_pow_of_two(max_t(size_t, 1,
+				num_pages / dedup_pages_per_bucket));
+
+		rzs->dedup_table = vmalloc(buckets * sizeof(*rzs->dedup_table));
+		if (!rzs->dedup_table) {
+			pr_err("Error allocating dedup hash table\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+		memset(rzs->dedup_table, 0,
+			buckets * sizeof(*rzs->dedup_table));
+		rzs->dedup_mask = buckets - 1;
+	}
+
+	/* The swap header is not accounted in stats */
 	page = alloc_page(__GFP_ZERO);
 	if (!page) {
 		pr_err("Error allocating swap header page\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
-	rzs->table[0].page = page;
+	rzs->table[0].obj = kmem_cache_zalloc(rzs_object_cache, GFP_KERNEL);
+	if (!rzs->table[0].obj) {
+		__free_page(page);
+		pr_err("Error allocating swap header object\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	INIT_HLIST_NODE(&rzs->table[0].obj->hash);
+	rzs->table[0].obj->page = page;
+	rzs->table[0].obj->size = PAGE_SIZE;
+	rzs->table[0].obj->refcount = 1;
+	rzs->table[0].obj->atime = jiffies;
 	rzs_set_flag(rzs, 0, RZS_UNCOMPRESSED);
 
+	if (rzs->backing_name[0]) {
+		ret = rzs_setup_backing(rzs);
+		if (ret)
+			goto fail;
+	}
+
 	swap_header = kmap(page);
 	setup_swap_header(rzs, swap_header);
 	kunmap(page);
@@ -592,12 +1429,18 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	}
 
 	rzs->init_done = 1;
+	mutex_unlock(&rzs->lock);
+
+	if (rzs->backing_bdev)
+		queue_delayed_work(rzs_wb_wq, &rzs->wb_scan_work,
+				writeback_scan_interval);
 
 	pr_debug("Initialization done!\n");
 	return 0;
 
 fail:
 	reset_device(rzs);
+	mutex_unlock(&rzs->lock);
 
 	pr_err("Initialization failed: err=%d\n", ret);
 	return ret;
@@ -605,8 +1448,10 @@ fail:
 
 static int ramzswap_ioctl_reset_device(struct ramzswap *rzs)
 {
+	mutex_lock(&rzs->lock);
 	if (rzs->init_done)
 		reset_device(rzs);
+	mutex_unlock(&rzs->lock);
 
 	return 0;
 }
@@ -634,9 +1479,52 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		pr_info("Disk size set to %zu kB\n", disksize_kb);
 		break;
 
+	case RZSIO_SET_COMPRESSOR:
+	{
+		char name[RZS_COMPRESSOR_NAME_LEN];
+		const struct rzs_backend *backend;
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(name, (void *)arg, sizeof(name))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		name[sizeof(name) - 1] = '\0';
+		backend = rzs_find_backend(name);
+		if (!backend) {
+			ret = -EINVAL;
+			goto out;
+		}
+		rzs->backend = backend;
+		pr_info("Compressor set to %s\n", backend->name);
+		break;
+	}
+
+	case RZSIO_SET_BACKING_DEV:
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(rzs->backing_name, (void *)arg,
+					sizeof(rzs->backing_name))) {
+			rzs->backing_name[0] = '\0';
+			ret = -EFAULT;
+			goto out;
+		}
+		rzs->backing_name[sizeof(rzs->backing_name) - 1] = '\0';
+		pr_info("Backing device set to %s\n", rzs->backing_name);
+		break;
+
 	case RZSIO_GET_STATS:
+	case RZSIO_GET_STATS_EXT:
 	{
-		struct ramzswap_ioctl_stats *stats;
+		struct ramzswap_ioctl_stats_ext *stats;
+		size_t len = cmd == RZSIO_GET_STATS ?
+			sizeof(stats->base) : sizeof(*stats);
+
 		if (!rzs->init_done) {
 			ret = -ENOTTY;
 			goto out;
@@ -647,7 +1535,7 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 			goto out;
 		}
 		ramzswap_ioctl_get_stats(rzs, stats);
-		if (copy_to_user((void *)arg, stats, sizeof(*stats))) {
+		if (copy_to_user((void *)arg, stats, len)) {
 			kfree(stats);
 			ret = -EFAULT;
 			goto out;
@@ -705,6 +1593,14 @@ static int create_device(struct ramzswap *rzs, int device_id)
 
 	mutex_init(&rzs->lock);
 	spin_lock_init(&rzs->stat64_lock);
+	spin_lock_init(&rzs->dedup_lock);
+	spin_lock_init(&rzs->wb_lock);
+	init_completion(&rzs->wb_done);
+	INIT_DELAYED_WORK(&rzs->wb_work, rzs_writeback_work);
+	INIT_DELAYED_WORK(&rzs->wb_scan_work, rzs_writeback_scan);
+	spin_lock_init(&rzs->stream_lock);
+	INIT_LIST_HEAD(&rzs->idle_streams);
+	init_waitqueue_head(&rzs->stream_wait);
 
 	rzs->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!rzs->queue) {
@@ -770,11 +1666,29 @@ static int __init ramzswap_init(void)
 		goto out;
 	}
 
+	if (!rzs_find_backend(compressor)) {
+		pr_warning("Invalid value for compressor: %s\n", compressor);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	rzs_object_cache = KMEM_CACHE(rzs_object, 0);
+	if (!rzs_object_cache) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	rzs_wb_wq = create_singlethread_workqueue("ramzswap_wb");
+	if (!rzs_wb_wq) {
+		ret = -ENOMEM;
+		goto free_cache;
+	}
+
 	ramzswap_major = register_blkdev(0, "ramzswap");
 	if (ramzswap_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_wq;
 	}
 
 	if (!num_devices) {
@@ -803,6 +1717,10 @@ free_devices:
 		destroy_device(&devices[--dev_id]);
 unregister:
 	unregister_blkdev(ramzswap_major, "ramzswap");
+free_wq:
+	destroy_workqueue(rzs_wb_wq);
+free_cache:
+	kmem_cache_destroy(rzs_object_cache);
 out:
 	return ret;
 }
@@ -823,12 +1741,24 @@ static void __exit ramzswap_exit(void)
 	unregister_blkdev(ramzswap_major, "ramzswap");
 
 	kfree(devices);
+	destroy_workqueue(rzs_wb_wq);
+	kmem_cache_destroy(rzs_object_cache);
 	pr_debug("Cleanup done!\n");
 }
 
 module_param(num_devices, uint, 0);
 MODULE_PARM_DESC(num_devices, "Number of ramzswap devices");
 
+module_param(compressor, charp, 0);
+MODULE_PARM_DESC(compressor, "Default compressor: lzo or zlib");
+
+module_param(dedup, bool, 0);
+MODULE_PARM_DESC(dedup, "Share storage between identical pages");
+
+module_param(writeback_idle_secs, uint, 0644);
+MODULE_PARM_DESC(writeback_idle_secs,
+	"Move pages idle this long to the backing device (0: never)");
+
 module_init(ramzswap_init);
 module_exit(ramzswap_exit);
 
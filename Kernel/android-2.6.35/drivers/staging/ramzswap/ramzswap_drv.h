@@ -17,6 +17,10 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/list.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
 
 #include "ramzswap_ioctl.h"
 #include "xvmalloc.h"
@@ -44,6 +48,23 @@ struct zobj_header {
 /* Default ramzswap disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Compressor used when none is selected with RZSIO_SET_COMPRESSOR */
+static const char default_compressor[] = "lzo";
+
+/* One dedup hash bucket per this many pages of disksize */
+static const unsigned dedup_pages_per_bucket = 4;
+
+/*
+ * Writeback to the backing device: pages are queued (up to
+ * RZS_WB_QUEUE_LEN) and written RZS_WB_BATCH at a time to consecutive
+ * backing slots. Idle pages are looked for RZS_WB_SCAN_CHUNK table
+ * entries at a time, once per writeback_scan_interval.
+ */
+#define RZS_WB_QUEUE_LEN	256
+#define RZS_WB_BATCH		32
+#define RZS_WB_SCAN_CHUNK	1024
+static const unsigned long writeback_scan_interval = HZ;
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -71,22 +92,53 @@ enum rzs_pageflags {
 	/* Page consists entirely of zeros */
 	RZS_ZERO,
 
+	/* Page was written to the backing device (table[].slot) */
+	RZS_BACKED,
+
 	__NR_RZS_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * A stored page: either an xvmalloc object holding compressed data or a
+ * whole page holding it as-is. Swap slots with identical contents share
+ * one object (see rzs_dedup_find()).
+ */
+struct rzs_object {
+	struct hlist_node hash;	/* dedup_table chain */
+	struct page *page;
+	u32 offset;
+	u32 size;		/* compressed size, PAGE_SIZE if stored as-is */
+	u32 checksum;		/* of the uncompressed page */
+	u32 refcount;		/* table entries using this object */
+	u32 index;		/* table entry it was first stored for */
+	unsigned long atime;	/* jiffies of last read or write */
+};
+
 /*
  * Allocated for each swap slot, indexed by page no.
  * These table entries must fit exactly in a page.
  */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	union {
+		struct rzs_object *obj;
+		unsigned long slot;	/* backing page, if RZS_BACKED */
+	};
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/* A page being written back */
+struct rzs_wb_io {
+	struct ramzswap *rzs;
+	struct rzs_object *obj;	/* holds a reference */
+	u32 index;
+	unsigned long slot;
+	struct page *page;	/* data written: obj->page or a copy */
+	struct bio *bio;
+	int error;
+};
+
 struct ramzswap_stats {
 	/* basic stats */
 	size_t compr_size;	/* compressed size of pages stored -
@@ -99,20 +151,81 @@ struct ramzswap_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-swap I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 dedup_hits;		/* writes satisfied by an existing object */
+	u64 wb_written;		/* pages written to the backing device */
+	u64 wb_read;		/* pages read from the backing device */
+	u64 wb_failed;		/* writebacks that could not be done */
 	u32 pages_zero;		/* no. of zero filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 objects;		/* no. of distinct objects stored */
+	u32 objects_expand;	/* no. of those stored uncompressed */
+	u32 pages_backed;	/* no. of pages on the backing device */
 #endif
 };
 
+/*
+ * Compressor backend. compress() always consumes PAGE_SIZE bytes and
+ * may write up to 2 * PAGE_SIZE bytes to dst; decompress() must produce
+ * exactly PAGE_SIZE bytes. Both return 0 on success.
+ */
+struct rzs_backend {
+	const char *name;
+	void *(*alloc_workmem)(void);
+	void (*free_workmem)(void *workmem);
+	int (*compress)(void *workmem, const unsigned char *src,
+			unsigned char *dst, size_t *dst_len);
+	int (*decompress)(void *workmem, const unsigned char *src,
+			size_t src_len, unsigned char *dst);
+	/* decompress() uses workmem, so reads must hold a stream */
+	int decompress_needs_workmem;
+};
+
+/*
+ * Compression context: backend working memory plus an output buffer.
+ * Each device has one per online CPU so that swap-outs on different
+ * CPUs compress in parallel.
+ */
+struct ramzswap_stream {
+	struct list_head list;
+	void *workmem;
+	void *buffer;
+};
+
 struct ramzswap {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct list_head idle_streams;	/* free compression streams */
+	spinlock_t stream_lock;		/* protects idle_streams */
+	wait_queue_head_t stream_wait;	/* for a stream to become idle */
+	int num_streams;
+	const struct rzs_backend *backend;
+	struct hlist_head *dedup_table;	/* NULL if dedup is disabled */
+	u32 dedup_mask;
+	spinlock_t dedup_lock;	/* protects dedup_table, object refcounts
+				 * and table[].obj/slot changes made while
+				 * the slot may be in use */
+
+	/* Optional backing device for incompressible and idle pages */
+	char backing_name[RZS_BACKING_NAME_LEN];
+	struct block_device *backing_bdev;
+	unsigned long backing_pages;
+	unsigned long *backing_map;	/* allocated backing slots */
+	unsigned long backing_next;	/* slot allocation cursor */
+	spinlock_t wb_lock;		/* protects backing_map, wb_queue;
+					 * nests outside dedup_lock */
+	struct rzs_wb_io *wb_queue;	/* RZS_WB_QUEUE_LEN pending pages */
+	unsigned int wb_head, wb_count;
+	struct rzs_wb_io *wb_batch;	/* RZS_WB_BATCH pages in flight */
+	atomic_t wb_pending;
+	struct completion wb_done;
+	struct delayed_work wb_work;
+	struct delayed_work wb_scan_work;
+	u32 wb_scan_index;
+
 	struct table *table;
-	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;
+	spinlock_t stat64_lock;	/* protect stats */
+	struct mutex lock;	/* serializes device init and reset */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -130,14 +243,18 @@ struct ramzswap {
 
 /* Debugging and Stats */
 #if defined(CONFIG_RAMZSWAP_STATS)
-static void rzs_stat_inc(u32 *v)
+static void rzs_stat_inc(struct ramzswap *rzs, u32 *v)
 {
+	spin_lock(&rzs->stat64_lock);
 	*v = *v + 1;
+	spin_unlock(&rzs->stat64_lock);
 }
 
-static void rzs_stat_dec(u32 *v)
+static void rzs_stat_dec(struct ramzswap *rzs, u32 *v)
 {
+	spin_lock(&rzs->stat64_lock);
 	*v = *v - 1;
+	spin_unlock(&rzs->stat64_lock);
 }
 
 static void rzs_stat64_inc(struct ramzswap *rzs, u64 *v)
@@ -158,8 +275,8 @@ static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 	return val;
 }
 #else
-#define rzs_stat_inc(v)
-#define rzs_stat_dec(v)
+#define rzs_stat_inc(r, v)
+#define rzs_stat_dec(r, v)
 #define rzs_stat64_inc(r, v)
 #define rzs_stat64_read(r, v)
 #endif /* CONFIG_RAMZSWAP_STATS */
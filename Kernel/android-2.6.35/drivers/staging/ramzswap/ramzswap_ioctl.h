@@ -15,6 +15,9 @@
 #ifndef _RAMZSWAP_IOCTL_H_
 #define _RAMZSWAP_IOCTL_H_
 
+#define RZS_COMPRESSOR_NAME_LEN	16
+#define RZS_BACKING_NAME_LEN	128
+
 struct ramzswap_ioctl_stats {
 	u64 disksize;		/* user specified or equal to backing swap
 				 * size (if present) */
@@ -34,9 +37,28 @@ struct ramzswap_ioctl_stats {
 	u64 mem_used_total;
 } __attribute__ ((packed, aligned(4)));
 
+/*
+ * RZSIO_GET_STATS keeps its original layout, and with it its ioctl number,
+ * for existing rzscontrol binaries; newer stats are only reported here.
+ */
+struct ramzswap_ioctl_stats_ext {
+	struct ramzswap_ioctl_stats base;
+	u64 dedup_hits;		/* writes that reused a stored object */
+	u32 pages_dedup;	/* stored pages sharing another's object */
+	u32 compr_ratio_pct;	/* compr_data_size / orig_data_size */
+	char compressor[RZS_COMPRESSOR_NAME_LEN];
+	u64 wb_written;		/* pages written to the backing device */
+	u64 wb_read;		/* pages read back from it */
+	u64 wb_failed;		/* writebacks dropped (device full, errors) */
+	u32 pages_backed;	/* pages currently on the backing device */
+} __attribute__ ((packed, aligned(4)));
+
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+#define RZSIO_SET_COMPRESSOR	_IOW('z', 4, char[RZS_COMPRESSOR_NAME_LEN])
+#define RZSIO_SET_BACKING_DEV	_IOW('z', 5, char[RZS_BACKING_NAME_LEN])
+#define RZSIO_GET_STATS_EXT	_IOR('z', 6, struct ramzswap_ioctl_stats_ext)
 
 #endif
@@ -34,6 +34,28 @@
  */
 #define PMEM_GET_TOTAL_SIZE	_IOW(PMEM_IOCTL_MAGIC, 7, unsigned int)
 #define PMEM_CACHE_FLUSH	_IOW(PMEM_IOCTL_MAGIC, 8, unsigned int)
+/* Selects how this file's allocation is mapped by the next mmap; pass one
+ * of the PMEM_CACHE_POLICY values below as the argument. Fails with EBUSY
+ * once the file has been mmaped.
+ */
+#define PMEM_SET_CACHE_POLICY	_IOW(PMEM_IOCTL_MAGIC, 9, unsigned int)
+/* Cleans and/or invalidates the CPU caches for a byte range of the
+ * allocation, pass a pmem_cache_range struct as the argument. Only the
+ * given range is maintained; it must lie inside the allocation, or inside
+ * one of the mapped regions for a connected file.
+ */
+#define PMEM_CACHE_RANGE	_IOW(PMEM_IOCTL_MAGIC, 10, unsigned int)
+
+/* cache policies for PMEM_SET_CACHE_POLICY */
+#define PMEM_CACHE_POLICY_DEFAULT	0 /* per region, O_SYNC for uncached */
+#define PMEM_CACHE_POLICY_UNCACHED	1
+#define PMEM_CACHE_POLICY_WRITECOMBINE	2
+#define PMEM_CACHE_POLICY_CACHED	3
+
+/* operations for PMEM_CACHE_RANGE */
+#define PMEM_CACHE_CLEAN		1 /* write back, before a device reads */
+#define PMEM_CACHE_INVALIDATE		2 /* discard, before the cpu reads */
+#define PMEM_CACHE_CLEAN_INVALIDATE	3
 
 struct android_pmem_platform_data
 {
@@ -57,6 +79,12 @@ struct pmem_region {
 	unsigned long len;
 };
 
+struct pmem_cache_range {
+	unsigned long offset;
+	unsigned long len;
+	unsigned int op;
+};
+
 #ifdef CONFIG_ANDROID_PMEM
 int is_pmem_file(struct file *file);
 int get_pmem_file(int fd, unsigned long *start, unsigned long *vstart,
@@ -20,6 +20,7 @@
 #include <linux/completion.h>
 #include <linux/workqueue.h>
 #include <linux/cpumask.h>
+#include <linux/ktime.h>
 #include <asm/div64.h>
 
 #define CPUFREQ_NAME_LEN 16
@@ -31,6 +32,7 @@
 
 #define CPUFREQ_TRANSITION_NOTIFIER	(0)
 #define CPUFREQ_POLICY_NOTIFIER		(1)
+#define CPUFREQ_TARGET_NOTIFIER		(2)
 
 #ifdef CONFIG_CPU_FREQ
 int cpufreq_register_notifier(struct notifier_block *nb, unsigned int list);
@@ -104,6 +106,10 @@ struct cpufreq_policy {
 
 	struct kobject		kobj;
 	struct completion	kobj_unregister;
+
+	ktime_t			sample_time; /* when the governor sample
+					 * leading to the next target
+					 * call started, 0 if none */
 };
 
 #define CPUFREQ_ADJUST		(0)
@@ -130,6 +136,23 @@ struct cpufreq_freqs {
 	u8 flags;		/* flags of cpufreq_driver, see below. */
 };
 
+/********************** cpufreq target notifiers *********************/
+
+#define CPUFREQ_TARGETDONE	(0)
+
+/*
+ * Passed to the target notifiers after every successful call into the
+ * driver's ->target(). old == new if the driver had nothing to do.
+ */
+struct cpufreq_target_times {
+	unsigned int cpu;	/* policy->cpu */
+	unsigned int old;
+	unsigned int new;
+	s64 decision_us;	/* governor sample to target call, or -1 */
+	s64 transition_us;	/* time spent in ->target(), including any
+				 * voltage scaling done by the driver */
+};
+
 
 /**
  * cpufreq_scale - "old * mult / div" calculation for large values (32-bit-arch safe)
@@ -191,6 +214,14 @@ extern int __cpufreq_driver_target(struct cpufreq_policy *policy,
 				   unsigned int relation);
 
 
+/*
+ * governors call these when they start and finish evaluating the load of
+ * a policy; a sample that hands its target call to another context only
+ * ends the sample when it does not do so
+ */
+extern void cpufreq_governor_sample(struct cpufreq_policy *policy);
+extern void cpufreq_governor_sample_end(struct cpufreq_policy *policy);
+
 extern int __cpufreq_driver_getavg(struct cpufreq_policy *policy,
 				   unsigned int cpu);
 
@@ -373,6 +404,9 @@ extern struct cpufreq_governor cpufreq_gov_conservative;
 #elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_HOTPLUG)
 extern struct cpufreq_governor cpufreq_gov_hotplug;
 #define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_hotplug)
+#elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE)
+extern struct cpufreq_governor cpufreq_gov_interactive;
+#define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_interactive)
 #endif
 
 
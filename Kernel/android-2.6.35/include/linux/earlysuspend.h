@@ -18,6 +18,7 @@
 
 #ifdef CONFIG_HAS_EARLYSUSPEND
 #include <linux/list.h>
+#include <linux/types.h>
 #endif
 
 /* The early_suspend structure defines suspend and resume hooks to be called
@@ -25,10 +26,15 @@
  * control the order. They can be used to turn off the screen and input
  * devices that are not used for wakeup.
  * Suspend handlers are called in low to high level order, resume handlers are
- * called in the opposite order. If, when calling register_early_suspend,
- * the suspend handlers have already been called without a matching call to the
- * resume handlers, the suspend handler will be called directly from
- * register_early_suspend. This direct call can violate the normal level order.
+ * called in the opposite order. Handlers that share a level run one after
+ * the other in registration order, except that handlers which set 'async'
+ * are started in parallel with the rest of their level. Set it only for a
+ * handler that does not depend on any other handler at its level. Either
+ * way, all handlers of a level finish before the next level starts.
+ * If, when calling register_early_suspend, the suspend handlers have already
+ * been called without a matching call to the resume handlers, the suspend
+ * handler will be called directly from register_early_suspend. This direct
+ * call can violate the normal level order.
  */
 enum {
 	EARLY_SUSPEND_LEVEL_BLANK_SCREEN = 50,
@@ -41,6 +47,14 @@ struct early_suspend {
 	int level;
 	void (*suspend)(struct early_suspend *h);
 	void (*resume)(struct early_suspend *h);
+	bool async;
+	/* time spent in the handlers, reset by register_early_suspend */
+	struct {
+		s64 suspend_us;
+		s64 suspend_max_us;
+		s64 resume_us;
+		s64 resume_max_us;
+	} stat;
 #endif
 };
 
@@ -14,6 +14,8 @@
 
 struct zonelist;
 struct notifier_block;
+struct mm_struct;
+struct task_struct;
 
 /*
  * Types of limitations to the nodes from which allocations may occur
@@ -43,5 +45,43 @@ static inline void oom_killer_enable(void)
 {
 	oom_killer_disabled = false;
 }
+
+/*
+ * The Android low memory killer keeps every process that owns an mm in a
+ * list per oom_adj value, so that it does not have to walk the whole
+ * tasklist to find a victim.  These hooks keep that index current.
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_task_init(struct task_struct *tsk);
+extern void lowmem_task_add(struct task_struct *tsk);
+extern void lowmem_task_remove(struct task_struct *tsk);
+extern void lowmem_task_adj_changed(struct task_struct *tsk);
+extern void lowmem_mm_release(struct mm_struct *mm);
+extern void lowmem_pressure_notify(void);
+#else
+static inline void lowmem_task_init(struct task_struct *tsk)
+{
+}
+
+static inline void lowmem_task_add(struct task_struct *tsk)
+{
+}
+
+static inline void lowmem_task_remove(struct task_struct *tsk)
+{
+}
+
+static inline void lowmem_task_adj_changed(struct task_struct *tsk)
+{
+}
+
+static inline void lowmem_mm_release(struct mm_struct *mm)
+{
+}
+
+static inline void lowmem_pressure_notify(void)
+{
+}
+#endif
 #endif /* __KERNEL__*/
 #endif /* _INCLUDE_LINUX_OOM_H */
@@ -5,6 +5,7 @@
  */
 
 #include <linux/mm.h>
+#include <linux/oom.h>
 #include <linux/slab.h>
 #include <linux/interrupt.h>
 #include <linux/module.h>
@@ -690,6 +691,7 @@ static void exit_mm(struct task_struct * tsk)
 	/* We don't want this task to be frozen prematurely */
 	clear_freeze_flag(tsk);
 	task_unlock(tsk);
+	lowmem_task_remove(tsk);
 	mm_update_next_owner(mm);
 	mmput(mm);
 }
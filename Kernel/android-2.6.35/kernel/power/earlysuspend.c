@@ -13,10 +13,14 @@
  *
  */
 
+#include <linux/async.h>
+#include <linux/debugfs.h>
 #include <linux/earlysuspend.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
@@ -30,8 +34,15 @@ enum {
 static int debug_mask = DEBUG_USER_STATE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/* start the handlers that set 'async' in parallel with their level */
+static int parallel = 1;
+module_param(parallel, int, S_IRUGO | S_IWUSR | S_IWGRP);
+
 static DEFINE_MUTEX(early_suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
+static LIST_HEAD(early_suspend_domain);
+static s64 early_suspend_us;
+static s64 late_resume_us;
 static void early_suspend(struct work_struct *work);
 static void late_resume(struct work_struct *work);
 static DECLARE_WORK(early_suspend_work, early_suspend);
@@ -46,10 +57,55 @@ static int state;
 //&*&*&*BC1_110817: fix the issue that user can see screen switch when device resume
 extern void LCD_3V3_enable(int enable);
 //&*&*&*BC2_110817: fix the issue that user can see screen switch when device resume
+
+static void early_suspend_account(s64 *last, s64 *max, ktime_t start)
+{
+	*last = ktime_us_delta(ktime_get(), start);
+	if (*last > *max)
+		*max = *last;
+}
+
+static void early_suspend_call(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *handler = data;
+	ktime_t start = ktime_get();
+
+	handler->suspend(handler);
+	early_suspend_account(&handler->stat.suspend_us,
+			      &handler->stat.suspend_max_us, start);
+}
+
+static void late_resume_call(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *handler = data;
+	ktime_t start = ktime_get();
+
+	handler->resume(handler);
+	early_suspend_account(&handler->stat.resume_us,
+			      &handler->stat.resume_max_us, start);
+}
+
+/*
+ * Handlers that opted in with 'async' are started in the background, the
+ * others are called in list order, and the next level only begins once all
+ * handlers of this one have returned. Caller must hold early_suspend_lock.
+ */
+static void early_suspend_run(struct early_suspend *handler, int level,
+			      async_func_ptr *func)
+{
+	if (handler->level != level)
+		async_synchronize_full_domain(&early_suspend_domain);
+	if (parallel && handler->async)
+		async_schedule_domain(func, handler, &early_suspend_domain);
+	else
+		func(handler, 0);
+}
+
 void register_early_suspend(struct early_suspend *handler)
 {
 	struct list_head *pos;
 
+	memset(&handler->stat, 0, sizeof(handler->stat));
 	mutex_lock(&early_suspend_lock);
 	list_for_each(pos, &early_suspend_handlers) {
 		struct early_suspend *e;
@@ -59,7 +115,7 @@ void register_early_suspend(struct early_suspend *handler)
 	}
 	list_add_tail(&handler->link, pos);
 	if ((state & SUSPENDED) && handler->suspend)
-		handler->suspend(handler);
+		early_suspend_call(handler, 0);
 	mutex_unlock(&early_suspend_lock);
 }
 EXPORT_SYMBOL(register_early_suspend);
@@ -76,7 +132,8 @@ static void early_suspend(struct work_struct *work)
 {
 	struct early_suspend *pos;
 	unsigned long irqflags;
-	int abort = 0;
+	int abort = 0, level = INT_MIN;
+	ktime_t start;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -95,14 +152,20 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
+	start = ktime_get();
 	list_for_each_entry(pos, &early_suspend_handlers, link) {
-		if (pos->suspend != NULL)
-			pos->suspend(pos);
+		if (pos->suspend != NULL) {
+			early_suspend_run(pos, level, early_suspend_call);
+			level = pos->level;
+		}
 	}
+	async_synchronize_full_domain(&early_suspend_domain);
+	early_suspend_us = ktime_us_delta(ktime_get(), start);
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
-		pr_info("early_suspend: sync\n");
+		pr_info("early_suspend: sync, handlers took %lld us\n",
+			early_suspend_us);
 
 	sys_sync();
 abort:
@@ -116,7 +179,8 @@ static void late_resume(struct work_struct *work)
 {
 	struct early_suspend *pos;
 	unsigned long irqflags;
-	int abort = 0;
+	int abort = 0, level = INT_MAX;
+	ktime_t start;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -133,11 +197,17 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
-	list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
-		if (pos->resume != NULL)
-			pos->resume(pos);
+	start = ktime_get();
+	list_for_each_entry_reverse(pos, &early_suspend_handlers, link) {
+		if (pos->resume != NULL) {
+			early_suspend_run(pos, level, late_resume_call);
+			level = pos->level;
+		}
+	}
+	async_synchronize_full_domain(&early_suspend_domain);
+	late_resume_us = ktime_us_delta(ktime_get(), start);
 	if (debug_mask & DEBUG_SUSPEND)
-		pr_info("late_resume: done\n");
+		pr_info("late_resume: done in %lld us\n", late_resume_us);
 abort:
 	mutex_unlock(&early_suspend_lock);
 }
@@ -181,3 +251,46 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int early_suspend_stats_show(struct seq_file *m, void *unused)
+{
+	struct early_suspend *pos;
+
+	mutex_lock(&early_suspend_lock);
+	seq_printf(m, "early_suspend %lld us, late_resume %lld us\n",
+		   early_suspend_us, late_resume_us);
+	seq_puts(m, "level\tasync\tsuspend_us\tsuspend_max_us\tresume_us"
+		 "\tresume_max_us\thandler\n");
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		seq_printf(m, "%d\t%d\t%lld\t%lld\t%lld\t%lld\t%pf\n",
+			   pos->level, pos->async, pos->stat.suspend_us,
+			   pos->stat.suspend_max_us, pos->stat.resume_us,
+			   pos->stat.resume_max_us,
+			   pos->suspend ? (void *)pos->suspend :
+					  (void *)pos->resume);
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_stats_show, NULL);
+}
+
+static const struct file_operations early_suspend_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = early_suspend_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init early_suspend_debug_init(void)
+{
+	debugfs_create_file("early_suspend", S_IRUGO, NULL, NULL,
+			    &early_suspend_stats_fops);
+	return 0;
+}
+late_initcall(early_suspend_debug_init);
+#endif
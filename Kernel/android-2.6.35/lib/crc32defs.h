@@ -15,6 +15,13 @@
 # define CRC_BE_BITS 8
 #endif
 
+/*
+ * The 8 bit table code consumes 8 bytes per step ("slicing by 8"), with
+ * one table per byte position: table n is the CRC of a byte followed by
+ * n zero bytes.
+ */
+#define CRC_SLICES 8
+
 /*
  * Little-endian CRC computation.  Used with serial bit streams sent
  * lsbit-first.  Be sure to use cpu_to_le32() to append the computed CRC.